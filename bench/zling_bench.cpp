@@ -0,0 +1,446 @@
+/**
+ * zling:
+ *  light-weight lossless data compression utility.
+ *
+ * Copyright (C) 2012-2013 by Zhang Li <zhangli10 at baidu.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * @author zhangli10<zhangli10@baidu.com>
+ * @brief  stage-level benchmark: rolz/huffman encode and decode throughput and ratio on
+ *         generated (or given) corpora, results written as JSON.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/time.h>
+#include <vector>
+
+#if HAS_CXX11_SUPPORT
+#include <cstdint>
+#else
+#include <stdint.h>
+#include <inttypes.h>
+#endif
+
+#include "src/zling_codec.h"
+
+using baidu::zling::codec::ZlingRoundEncoder;
+using baidu::zling::codec::ZlingRoundDecoder;
+using baidu::zling::codec::ZlingStageTimes;
+using baidu::zling::codec::kBlockSizeIn;
+using baidu::zling::codec::kBlockSizeOut;
+using baidu::zling::codec::kRoundHeaderSize;
+using baidu::zling::lz::kDefaultLevel;
+using baidu::zling::lz::kMinLevel;
+using baidu::zling::lz::kMaxLevel;
+
+static inline double GetTimeStart() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+static inline double GetTimeCost(double time_start) {
+    return GetTimeStart() - time_start;
+}
+
+// ZlingRandom: xorshift generator, corpora must be the same on every run and platform.
+class ZlingRandom {
+public:
+    ZlingRandom(uint64_t seed): m_state(seed) {}
+
+    uint32_t Next() {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        return m_state >> 32;
+    }
+    int Next(int n) {  // 0 .. n - 1
+        return Next() % n;
+    }
+    int NextZipf(int n) {  // 0 .. n - 1, rank k with probability ~ 1 / (k + 1)
+        return std::min(n - 1, int(pow(n, Next() / 4294967296.0)) - 1);
+    }
+
+private:
+    uint64_t m_state;
+};
+
+struct ZlingCorpus {
+    std::string name;
+    std::vector<unsigned char> data;
+};
+
+static void Append(std::vector<unsigned char>* data, const char* s) {
+    data->insert(data->end(), s, s + strlen(s));
+    return;
+}
+
+static void MakeText(int size, std::vector<unsigned char>* data) {
+    static const char* syllables[] = {
+        "the", "an", "in", "re", "er", "on", "at", "es", "or", "ti", "is", "it", "al", "ar", "st",
+        "to", "nt", "ng", "se", "ha", "as", "ou", "io", "le", "ve", "co", "me", "de", "hi", "ri",
+    };
+    static const int nsyllables = sizeof(syllables) / sizeof(syllables[0]);
+    std::vector<std::string> words;
+    ZlingRandom random(1);
+
+    for (int i = 0; i < 2000; i++) {  // vocabulary
+        std::string word;
+        for (int n = 1 + random.Next(3); n > 0; n--) {
+            word += syllables[random.Next(nsyllables)];
+        }
+        words.push_back(word);
+    }
+    for (int i = 0; int(data->size()) < size; i++) {
+        std::string word = words[random.NextZipf(words.size())];
+        if (i % 12 == 0) {
+            word[0] = toupper(word[0]);
+        }
+        Append(data, word.c_str());
+        Append(data, (i % 12 == 11) ? ".\n" : (random.Next(8) == 0) ? ", " : " ");
+    }
+    data->resize(size);
+    return;
+}
+
+static void MakeLogs(int size, std::vector<unsigned char>* data) {
+    static const char* levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARNING", "ERROR"};
+    static const char* modules[] = {"frontend", "backend", "storage", "scheduler", "auth"};
+    static const char* paths[] = {"/index.html", "/api/v1/query", "/api/v1/update", "/static/app.js", "/login"};
+    ZlingRandom random(2);
+    char line[256];
+    int64_t ms = 1388275200000LL;  // 2013-12-29
+
+    while (int(data->size()) < size) {
+        ms += random.Next(50);
+        snprintf(line, sizeof(line),
+                 "%lld.%03d [%s] %s: GET %s from 10.%d.%d.%d status=%d bytes=%d latency=%dms\n",
+                 static_cast<long long>(ms / 1000),
+                 static_cast<int>(ms % 1000),
+                 levels[random.Next(6)],
+                 modules[random.Next(5)],
+                 paths[random.NextZipf(5)],
+                 random.Next(4), random.Next(256), random.Next(256),
+                 (random.Next(20) == 0) ? 404 : 200,
+                 random.NextZipf(100000),
+                 random.NextZipf(2000));
+        Append(data, line);
+    }
+    data->resize(size);
+    return;
+}
+
+static void MakeBinary(int size, std::vector<unsigned char>* data) {
+    static const char* names[] = {"sensor_a", "sensor_b", "gateway", "probe_01", "probe_02"};
+    ZlingRandom random(3);
+    uint32_t id = 100000;
+    double value = 0;
+
+    while (int(data->size()) < size) {  // table-like records: little-endian integers, doubles, names
+        unsigned char record[32] = {0};
+
+        id += 1 + random.Next(3);
+        value += (random.Next(2001) - 1000) / 1000.0;
+        record[0] = id % 256;
+        record[1] = id / 256 % 256;
+        record[2] = id / 65536 % 256;
+        record[3] = id / 16777216 % 256;
+        record[4] = random.NextZipf(16);
+        record[6] = random.Next(2) ? 0x80 : 0x00;
+        memcpy(record + 8, &value, sizeof(value));
+        const char* name = names[random.NextZipf(5)];
+        memcpy(record + 16, name, strlen(name));
+        data->insert(data->end(), record, record + sizeof(record));
+    }
+    data->resize(size);
+    return;
+}
+
+static void MakeRandom(int size, std::vector<unsigned char>* data) {
+    ZlingRandom random(4);
+
+    data->resize(size);
+    for (int i = 0; i < size; i++) {
+        (*data)[i] = random.Next();
+    }
+    return;
+}
+
+static void MakeZero(int size, std::vector<unsigned char>* data) {
+    data->assign(size, 0);
+    return;
+}
+
+static int LoadFile(const char* path, std::vector<unsigned char>* data) {
+    FILE* fp = fopen(path, "rb");
+    unsigned char buf[65536];
+    size_t len;
+
+    if (fp == NULL) {
+        fprintf(stderr, "error: cannot open file '%s' for read.\n", path);
+        return -1;
+    }
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        data->insert(data->end(), buf, buf + len);
+    }
+    fclose(fp);
+    return 0;
+}
+
+struct ZlingBenchResult {
+    size_t size;
+    size_t encoded_size;
+    double encode;  // wall time (seconds) of each stage and of the whole encode/decode
+    double decode;
+    ZlingStageTimes encode_stages;
+    ZlingStageTimes decode_stages;
+};
+
+/* RunBench: encode and decode a corpus round by round, keeping the best time of each stage.
+ *  return:     0, -1 if decoded data differs
+ */
+static int RunBench(const ZlingCorpus& corpus, int level, int runs, ZlingBenchResult* result) {
+    ZlingRoundEncoder* encoder = new ZlingRoundEncoder();
+    ZlingRoundDecoder* decoder = new ZlingRoundDecoder();
+    std::vector<unsigned char> obuf(kBlockSizeOut + 16);
+    std::vector<unsigned char> dbuf(kBlockSizeIn);
+    std::vector<unsigned char> encoded;
+    std::vector<size_t> rounds;
+    const std::vector<unsigned char>& data = corpus.data;
+    int ret = 0;
+
+    encoder->SetLevel(level);
+    result->size = data.size();
+
+    for (int run = 0; run < runs && ret == 0; run++) {
+        double encode_start;
+        double decode_start;
+
+        // encode
+        encoded.clear();
+        rounds.clear();
+        encoder->ResetStageTimes();
+        encode_start = GetTimeStart();
+        for (size_t pos = 0; pos < data.size(); pos += kBlockSizeIn) {
+            int ilen = std::min(data.size() - pos, size_t(kBlockSizeIn));
+            int olen = encoder->Encode(&data[pos], ilen, &obuf[0]);
+
+            encoded.insert(encoded.end(), obuf.begin(), obuf.begin() + olen);
+            rounds.push_back(olen);
+        }
+        double encode_time = GetTimeCost(encode_start);
+        encoded.resize(encoded.size() + 16);  // decoder may read 16 bytes beyond
+
+        // decode
+        size_t ipos = 0;
+        size_t opos = 0;
+        decoder->ResetStageTimes();
+        decode_start = GetTimeStart();
+        for (size_t i = 0; i < rounds.size(); i++) {
+            int ilen = rounds[i] - kRoundHeaderSize;
+            int olen = decoder->Decode(&encoded[ipos + kRoundHeaderSize], ilen, &dbuf[0], kBlockSizeIn);
+
+            if (olen < 0 || opos + olen > data.size() || memcmp(&dbuf[0], &data[opos], olen) != 0) {
+                ret = -1;
+                break;
+            }
+            ipos += rounds[i];
+            opos += olen;
+        }
+        double decode_time = GetTimeCost(decode_start);
+        if (opos != data.size()) {
+            ret = -1;
+        }
+
+        if (run == 0 || encode_time < result->encode) {
+            result->encode = encode_time;
+        }
+        if (run == 0 || decode_time < result->decode) {
+            result->decode = decode_time;
+        }
+        if (run == 0 || encoder->GetStageTimes().rolz < result->encode_stages.rolz) {
+            result->encode_stages.rolz = encoder->GetStageTimes().rolz;
+        }
+        if (run == 0 || encoder->GetStageTimes().huffman < result->encode_stages.huffman) {
+            result->encode_stages.huffman = encoder->GetStageTimes().huffman;
+        }
+        if (run == 0 || decoder->GetStageTimes().rolz < result->decode_stages.rolz) {
+            result->decode_stages.rolz = decoder->GetStageTimes().rolz;
+        }
+        if (run == 0 || decoder->GetStageTimes().huffman < result->decode_stages.huffman) {
+            result->decode_stages.huffman = decoder->GetStageTimes().huffman;
+        }
+        result->encoded_size = ipos;
+    }
+    delete encoder;
+    delete decoder;
+    return ret;
+}
+
+static inline double GetSpeed(size_t size, double time) {  // MB/sec of uncompressed data
+    return (time > 0) ? size / 1e6 / time : 0;
+}
+
+// stages skipped for the whole corpus (stored blocks of random data) have no time and no speed:
+//  "-" in the table, null in the json, rather than a 0 that reads as a collapse.
+static std::string FormatSpeed(size_t size, double time) {
+    char buf[32] = "-";
+    if (time > 0) {
+        snprintf(buf, sizeof(buf), "%.2f", GetSpeed(size, time));
+    }
+    return buf;
+}
+
+static void WriteSpeed(FILE* fp, const char* name, size_t size, double time) {
+    if (time > 0) {
+        fprintf(fp, "      \"%s\": %.3f,\n", name, GetSpeed(size, time));
+    } else {
+        fprintf(fp, "      \"%s\": null,\n", name);
+    }
+    return;
+}
+
+int main(int argc, char** argv) {
+    std::vector<ZlingCorpus> corpora;
+    std::vector<const char*> files;
+    const char* output = NULL;
+    int size = 8;
+    int runs = 3;
+    int level = kDefaultLevel;
+    int ret = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            size = atoi(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            level = atoi(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+            continue;
+        }
+        if (argv[i][0] == '-') {
+            ret = -1;
+            break;
+        }
+        files.push_back(argv[i]);
+    }
+    if (ret == -1 || size <= 0 || size > 1024 || runs <= 0 || level < kMinLevel || level > kMaxLevel) {
+        fprintf(stderr, "usage:\n");
+        fprintf(stderr, "   zling_bench [-n size_mb] [-r runs] [-l level] [-o result.json] [file...]\n");
+        fprintf(stderr, "   benchmarks generated corpora (text, logs, binary, random, zero) of size_mb each,\n");
+        fprintf(stderr, "   or the given files, keeping the best of runs.\n");
+        return -1;
+    }
+
+    if (!files.empty()) {
+        for (size_t i = 0; i < files.size(); i++) {
+            corpora.push_back(ZlingCorpus());
+            corpora.back().name = files[i];
+            if (LoadFile(files[i], &corpora.back().data) == -1) {
+                return -1;
+            }
+        }
+    } else {
+        static const char* names[] = {"text", "logs", "binary", "random", "zero"};
+        static void (*generators[])(int, std::vector<unsigned char>*) = {
+            MakeText, MakeLogs, MakeBinary, MakeRandom, MakeZero,
+        };
+        for (int i = 0; i < 5; i++) {
+            corpora.push_back(ZlingCorpus());
+            corpora.back().name = names[i];
+            generators[i](size * 1048576, &corpora.back().data);
+        }
+    }
+
+    // run, print a table to stderr and JSON to output (stdout by default)
+    FILE* fp = (output != NULL) ? fopen(output, "w") : stdout;
+    if (fp == NULL) {
+        fprintf(stderr, "error: cannot open file '%s' for write.\n", output);
+        return -1;
+    }
+    fprintf(stderr, "%-12s %10s %7s %9s %9s %9s %9s %9s %9s  (MB/sec)\n",
+            "corpus", "size", "ratio", "rolz-enc", "huff-enc", "huff-dec", "rolz-dec", "encode", "decode");
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"level\": %d,\n", level);
+    fprintf(fp, "  \"runs\": %d,\n", runs);
+    fprintf(fp, "  \"unit\": \"MB/sec of uncompressed data, best of runs\",\n");
+    fprintf(fp, "  \"corpora\": [\n");
+
+    for (size_t i = 0; i < corpora.size(); i++) {
+        ZlingBenchResult r = ZlingBenchResult();
+        bool ok = (RunBench(corpora[i], level, runs, &r) == 0);
+
+        if (!ok) {
+            fprintf(stderr, "error: %s: decoded data differs.\n", corpora[i].name.c_str());
+            ret = -1;
+        }
+        double ratio = (r.size > 0) ? 1.0 * r.encoded_size / r.size : 0;
+
+        fprintf(stderr, "%-12s %10zu %6.2f%% %9s %9s %9s %9s %9s %9s\n",
+                corpora[i].name.c_str(),
+                r.size,
+                ratio * 100,
+                FormatSpeed(r.size, r.encode_stages.rolz).c_str(),
+                FormatSpeed(r.size, r.encode_stages.huffman).c_str(),
+                FormatSpeed(r.size, r.decode_stages.huffman).c_str(),
+                FormatSpeed(r.size, r.decode_stages.rolz).c_str(),
+                FormatSpeed(r.size, r.encode).c_str(),
+                FormatSpeed(r.size, r.decode).c_str());
+
+        fprintf(fp, "    {\n");
+        fprintf(fp, "      \"name\": \"%s\",\n", corpora[i].name.c_str());
+        fprintf(fp, "      \"size\": %zu,\n", r.size);
+        fprintf(fp, "      \"encoded_size\": %zu,\n", r.encoded_size);
+        fprintf(fp, "      \"ratio\": %.6f,\n", ratio);
+        WriteSpeed(fp, "rolz_encode", r.size, r.encode_stages.rolz);
+        WriteSpeed(fp, "huffman_encode", r.size, r.encode_stages.huffman);
+        WriteSpeed(fp, "huffman_decode", r.size, r.decode_stages.huffman);
+        WriteSpeed(fp, "rolz_decode", r.size, r.decode_stages.rolz);
+        WriteSpeed(fp, "encode", r.size, r.encode);
+        WriteSpeed(fp, "decode", r.size, r.decode);
+        fprintf(fp, "      \"ok\": %s\n", ok ? "true" : "false");
+        fprintf(fp, "    }%s\n", (i + 1 < corpora.size()) ? "," : "");
+    }
+    fprintf(fp, "  ]\n");
+    fprintf(fp, "}\n");
+
+    if (fp != stdout) {
+        fclose(fp);
+    }
+    return ret;
+}
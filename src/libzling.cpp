@@ -0,0 +1,676 @@
+/**
+ * zling:
+ *  light-weight lossless data compression utility.
+ *
+ * Copyright (C) 2012-2013 by Zhang Li <zhangli10 at baidu.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * @author zhangli10<zhangli10@baidu.com>
+ * @brief  libzling: in-memory compression API (C ABI).
+ */
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "src/libzling.h"
+#include "src/zling_codec.h"
+#include "src/zling_dict.h"
+
+using baidu::zling::codec::ZlingRoundEncoder;
+using baidu::zling::codec::ZlingRoundDecoder;
+using baidu::zling::codec::ZlingParseRound;
+using baidu::zling::codec::ZlingIndexEntry;
+using baidu::zling::codec::ZlingIndexSize;
+using baidu::zling::codec::ZlingWriteIndex;
+using baidu::zling::codec::ZlingReadIndexSize;
+using baidu::zling::codec::ZlingReadIndex;
+using baidu::zling::codec::ZlingReadWindow;
+using baidu::zling::codec::ZlingRoundOutSize;
+
+using baidu::zling::dict::ZlingTrainDictionary;
+using baidu::zling::dict::kDictMaxSize;
+
+using baidu::zling::codec::kBlockSizeIn;
+using baidu::zling::codec::kBlockSizeRolz;
+using baidu::zling::codec::kBlockSizeOut;
+using baidu::zling::codec::kRoundHeaderSize;
+using baidu::zling::codec::kBlockHeaderSize;
+using baidu::zling::codec::kChecksumHeaderSize;
+using baidu::zling::codec::kIndexTrailerSize;
+using baidu::zling::codec::kIndexMaxRounds;
+using baidu::zling::codec::kWindowHeaderSize;
+using baidu::zling::codec::kFlagWindow;
+
+// StageSize: max size of a round (header + body) of a stream with window.
+static inline int StageSize(int window) {
+    return kRoundHeaderSize + ZlingRoundOutSize(window);
+}
+
+struct zling_encoder {
+    ZlingRoundEncoder* encoder;
+    unsigned char* ibuf;  // pending input of current round (streaming)
+    unsigned char* obuf;  // encoded round not yet returned to caller
+    int ilen;
+    int opos;
+    int olen;
+    bool finished;
+
+    bool seekable;
+    bool indexed;
+    std::vector<ZlingIndexEntry> index;
+};
+
+struct zling_decoder {
+    ZlingRoundDecoder* decoder;
+    unsigned char* ibuf;  // staged stream data, at most one round (+1 byte of next round)
+    unsigned char* obuf;  // decoded round not yet returned to caller
+    int ilen;
+    int opos;
+    int olen;
+    bool finished;
+
+    int window;    // window of current stream (from its window frame), 0 until known (streaming)
+    int capacity;  // window ibuf/obuf are sized for
+
+    zling_sink sink;  // streaming output, instead of obuf drained to dst
+    void* sink_arg;
+};
+
+template <typename T>
+static inline T* NewArray(size_t size) {  // C callers get error codes, not exceptions
+    return new (std::nothrow) T[size];
+}
+
+template <typename T>
+static inline T Min(T x, T y) {
+    return x < y ? x : y;
+}
+
+size_t zling_compress_bound(size_t srclen) {
+    // each symbol costs at most 15.5 bits, plus tables/stream sizes/padding per block and headers
+    //  (round, checksum, dictionary) per round.
+    size_t rounds = srclen / kBlockSizeIn + 1;
+    size_t blocks = srclen / kBlockSizeRolz + rounds;
+    return srclen * 2 + rounds * (kRoundHeaderSize + kChecksumHeaderSize + kBlockHeaderSize) + blocks * (kBlockHeaderSize + 304) + ZlingIndexSize(rounds);
+}
+
+int zling_compress(const void* src, size_t srclen, void* dst, size_t* dstlen) {
+    zling_encoder* encoder = zling_encoder_create();
+    if (encoder == NULL) {
+        return ZLING_MEM_ERROR;
+    }
+    int ret = zling_encoder_compress(encoder, src, srclen, dst, dstlen);
+    zling_encoder_destroy(encoder);
+    return ret;
+}
+
+int zling_decompress(const void* src, size_t srclen, void* dst, size_t* dstlen) {
+    zling_decoder* decoder = zling_decoder_create();
+    if (decoder == NULL) {
+        return ZLING_MEM_ERROR;
+    }
+    int ret = zling_decoder_decompress(decoder, src, srclen, dst, dstlen);
+    zling_decoder_destroy(decoder);
+    return ret;
+}
+
+// encoder
+// ============================================================
+zling_encoder* zling_encoder_create(void) {
+    zling_encoder* encoder = new (std::nothrow) zling_encoder();
+    if (encoder == NULL) {
+        return NULL;
+    }
+    try {
+        encoder->encoder = new ZlingRoundEncoder();
+    } catch (...) {
+        delete encoder;
+        return NULL;
+    }
+    encoder->ibuf = NULL;  // allocated on demand
+    encoder->obuf = NULL;
+    encoder->seekable = false;
+    zling_encoder_reset(encoder);
+    return encoder;
+}
+
+void zling_encoder_destroy(zling_encoder* encoder) {
+    if (encoder != NULL) {
+        delete encoder->encoder;
+        delete [] encoder->ibuf;
+        delete [] encoder->obuf;
+        delete encoder;
+    }
+    return;
+}
+
+void zling_encoder_reset(zling_encoder* encoder) {
+    encoder->ilen = 0;
+    encoder->opos = 0;
+    encoder->olen = 0;
+    encoder->finished = false;
+    encoder->indexed = false;
+    encoder->index.clear();
+    return;
+}
+
+int zling_encoder_set_option(zling_encoder* encoder, int option, int value) {
+    switch (option) {
+        case ZLING_OPTION_SEEKABLE:
+            encoder->seekable = (value != 0);
+            return ZLING_OK;
+
+        case ZLING_OPTION_LEVEL:
+            if (value < baidu::zling::lz::kMinLevel || value > baidu::zling::lz::kMaxLevel) {
+                return ZLING_ERROR;
+            }
+            encoder->encoder->SetLevel(value);
+            return ZLING_OK;
+
+        case ZLING_OPTION_CHECKSUM:
+            encoder->encoder->SetChecksum(value != 0);
+            return ZLING_OK;
+
+        case ZLING_OPTION_PIPELINE:
+            encoder->encoder->SetPipeline(value != 0);
+            return ZLING_OK;
+    }
+    return ZLING_ERROR;
+}
+
+int zling_encoder_set_dictionary(zling_encoder* encoder, const void* dict, size_t dictlen) {
+    if (dictlen > size_t(kDictMaxSize) || (dict == NULL && dictlen > 0)) {
+        return ZLING_ERROR;
+    }
+    try {
+        encoder->encoder->SetDictionary(static_cast<const unsigned char*>(dict), dictlen);
+    } catch (...) {
+        return ZLING_MEM_ERROR;
+    }
+    return ZLING_OK;
+}
+
+// AddRound: record an encoded round in the index.
+static int AddRound(zling_encoder* encoder, int olen, int ilen) {
+    if (encoder->seekable) {
+        if (encoder->index.size() >= size_t(kIndexMaxRounds)) {
+            return ZLING_ERROR;
+        }
+        ZlingIndexEntry entry = {uint32_t(olen), uint32_t(ilen)};
+        encoder->index.push_back(entry);
+    }
+    return ZLING_OK;
+}
+
+int zling_encoder_compress(zling_encoder* encoder, const void* src, size_t srclen, void* dst, size_t* dstlen) {
+    const unsigned char* ibuf = static_cast<const unsigned char*>(src);
+    unsigned char* obuf = static_cast<unsigned char*>(dst);
+    size_t ipos = 0;
+    size_t opos = 0;
+
+    zling_encoder_reset(encoder);
+    while (ipos < srclen) {
+        int ilen = Min<size_t>(srclen - ipos, kBlockSizeIn);
+        int olen;
+
+        if (*dstlen - opos >= size_t(kBlockSizeOut)) {  // encode in place
+            olen = encoder->encoder->Encode(ibuf + ipos, ilen, obuf + opos);
+
+        } else {
+            if (encoder->obuf == NULL && (encoder->obuf = NewArray<unsigned char>(kBlockSizeOut)) == NULL) {
+                return ZLING_MEM_ERROR;
+            }
+            olen = encoder->encoder->Encode(ibuf + ipos, ilen, encoder->obuf);
+            if (size_t(olen) > *dstlen - opos) {
+                return ZLING_BUF_ERROR;
+            }
+            memcpy(obuf + opos, encoder->obuf, olen);
+        }
+        if (AddRound(encoder, olen, ilen) != ZLING_OK) {
+            return ZLING_ERROR;
+        }
+        ipos += ilen;
+        opos += olen;
+    }
+
+    if (encoder->seekable) {
+        if (size_t(ZlingIndexSize(encoder->index.size())) > *dstlen - opos) {
+            return ZLING_BUF_ERROR;
+        }
+        opos += ZlingWriteIndex(encoder->index, obuf + opos);
+    }
+    *dstlen = opos;
+    return ZLING_OK;
+}
+
+int zling_encoder_process(zling_encoder* encoder,
+                          const void* src, size_t* srclen,
+                          void* dst, size_t* dstlen,
+                          int finish) {
+    const unsigned char* ibuf = static_cast<const unsigned char*>(src);
+    unsigned char* obuf = static_cast<unsigned char*>(dst);
+    size_t ipos = 0;
+    size_t opos = 0;
+
+    if (encoder->ibuf == NULL && (encoder->ibuf = NewArray<unsigned char>(kBlockSizeIn)) == NULL) {
+        return ZLING_MEM_ERROR;
+    }
+    if (encoder->obuf == NULL && (encoder->obuf = NewArray<unsigned char>(kBlockSizeOut)) == NULL) {
+        return ZLING_MEM_ERROR;
+    }
+
+    while (true) {
+        // drain encoded round
+        int n = Min<size_t>(encoder->olen - encoder->opos, *dstlen - opos);
+        memcpy(obuf + opos, encoder->obuf + encoder->opos, n);
+        encoder->opos += n;
+        opos += n;
+        if (encoder->opos < encoder->olen) {
+            break;
+        }
+
+        // fill input round
+        n = Min<size_t>(kBlockSizeIn - encoder->ilen, *srclen - ipos);
+        memcpy(encoder->ibuf + encoder->ilen, ibuf + ipos, n);
+        encoder->ilen += n;
+        ipos += n;
+
+        if (encoder->ilen == kBlockSizeIn || (finish && ipos == *srclen && encoder->ilen > 0)) {
+            encoder->olen = encoder->encoder->Encode(encoder->ibuf, encoder->ilen, encoder->obuf);
+            encoder->opos = 0;
+            if (AddRound(encoder, encoder->olen, encoder->ilen) != ZLING_OK) {
+                return ZLING_ERROR;
+            }
+            encoder->ilen = 0;
+            continue;
+        }
+        if (finish && ipos == *srclen && encoder->seekable && !encoder->indexed) {
+            encoder->olen = ZlingWriteIndex(encoder->index, encoder->obuf);
+            encoder->opos = 0;
+            encoder->indexed = true;
+            continue;
+        }
+        encoder->finished = finish && ipos == *srclen;
+        break;
+    }
+    *srclen = ipos;
+    *dstlen = opos;
+    return encoder->finished ? ZLING_STREAM_END : ZLING_OK;
+}
+
+// decoder
+// ============================================================
+zling_decoder* zling_decoder_create(void) {
+    zling_decoder* decoder = new (std::nothrow) zling_decoder();
+    if (decoder == NULL) {
+        return NULL;
+    }
+    try {
+        decoder->decoder = new ZlingRoundDecoder();
+    } catch (...) {
+        delete decoder;
+        return NULL;
+    }
+    decoder->ibuf = NULL;  // allocated on demand
+    decoder->obuf = NULL;
+    decoder->capacity = kBlockSizeIn;
+    decoder->sink = NULL;
+    decoder->sink_arg = NULL;
+    zling_decoder_reset(decoder);
+    return decoder;
+}
+
+void zling_decoder_destroy(zling_decoder* decoder) {
+    if (decoder != NULL) {
+        delete decoder->decoder;
+        delete [] decoder->ibuf;
+        delete [] decoder->obuf;
+        delete decoder;
+    }
+    return;
+}
+
+void zling_decoder_reset(zling_decoder* decoder) {
+    decoder->ilen = 0;
+    decoder->opos = 0;
+    decoder->olen = 0;
+    decoder->finished = false;
+    decoder->window = 0;
+    return;
+}
+
+// SetWindow: window of current stream, buffers sized for a smaller one are grown (staged data kept).
+static int SetWindow(zling_decoder* decoder, int window) {
+    if (window > decoder->capacity) {
+        unsigned char* ibuf = NewArray<unsigned char>(StageSize(window) + 16);
+        if (ibuf == NULL) {
+            return ZLING_MEM_ERROR;
+        }
+        if (decoder->ibuf != NULL) {
+            memcpy(ibuf, decoder->ibuf, decoder->ilen);
+        }
+        delete [] decoder->ibuf;
+        delete [] decoder->obuf;
+        decoder->ibuf = ibuf;
+        decoder->obuf = NULL;  // allocated on demand
+        decoder->capacity = window;
+    }
+    decoder->window = window;
+    return ZLING_OK;
+}
+
+static int ReserveInput(zling_decoder* decoder) {  // decoder reads up to 16 bytes beyond a round
+    if (decoder->ibuf == NULL && (decoder->ibuf = NewArray<unsigned char>(StageSize(decoder->capacity) + 16)) == NULL) {
+        return ZLING_MEM_ERROR;
+    }
+    return ZLING_OK;
+}
+
+static int ReserveOutput(zling_decoder* decoder) {
+    if (decoder->obuf == NULL && (decoder->obuf = NewArray<unsigned char>(decoder->capacity)) == NULL) {
+        return ZLING_MEM_ERROR;
+    }
+    return ZLING_OK;
+}
+
+int zling_decoder_set_dictionary(zling_decoder* decoder, const void* dict, size_t dictlen) {
+    if (dictlen > size_t(kDictMaxSize) || (dict == NULL && dictlen > 0)) {
+        return ZLING_ERROR;
+    }
+    try {
+        decoder->decoder->SetDictionary(static_cast<const unsigned char*>(dict), dictlen);
+    } catch (...) {
+        return ZLING_MEM_ERROR;
+    }
+    return ZLING_OK;
+}
+
+int zling_decoder_set_sink(zling_decoder* decoder, zling_sink sink, void* arg) {
+    decoder->sink = sink;
+    decoder->sink_arg = arg;
+    return ZLING_OK;
+}
+
+static void PassToSink(const unsigned char* buf, int len, void* arg) {
+    zling_decoder* decoder = static_cast<zling_decoder*>(arg);
+    decoder->sink(buf, len, decoder->sink_arg);
+    return;
+}
+
+int zling_decoder_decompress(zling_decoder* decoder, const void* src, size_t srclen, void* dst, size_t* dstlen) {
+    const unsigned char* ibuf = static_cast<const unsigned char*>(src);
+    unsigned char* obuf = static_cast<unsigned char*>(dst);
+    size_t ipos = 0;
+    size_t opos = 0;
+    int window = ZlingReadWindow(ibuf, Min<size_t>(srclen, kWindowHeaderSize));
+
+    if (window == -1) {
+        return ZLING_ERROR;
+    }
+    if (SetWindow(decoder, window) != ZLING_OK) {
+        return ZLING_MEM_ERROR;
+    }
+
+    while (ipos < srclen) {
+        int need;
+        int hlen;
+        int dlen;
+        int len = Min<size_t>(srclen - ipos, StageSize(window) + 1);
+        int size = ZlingParseRound(ibuf + ipos, len, srclen - ipos == size_t(len), &need, &hlen, &dlen, window);
+        int olen;
+
+        if (size <= 0) {
+            return ZLING_ERROR;
+        }
+        const unsigned char* body = ibuf + ipos + hlen;
+
+        if (srclen - ipos - size < 16) {  // decoder reads up to 16 bytes beyond the round
+            if (ReserveInput(decoder) != ZLING_OK) {
+                return ZLING_MEM_ERROR;
+            }
+            memcpy(decoder->ibuf, body, size - hlen);
+            body = decoder->ibuf;
+        }
+
+        if (dlen >= 0 && *dstlen - opos >= size_t(dlen)) {  // decode in place
+            olen = decoder->decoder->Decode(body, size - hlen, obuf + opos, dlen);
+
+        } else {
+            if (ReserveOutput(decoder) != ZLING_OK) {
+                return ZLING_MEM_ERROR;
+            }
+            olen = decoder->decoder->Decode(body, size - hlen, decoder->obuf, window);
+            if (olen >= 0 && size_t(olen) > *dstlen - opos) {
+                return ZLING_BUF_ERROR;
+            }
+            if (olen >= 0) {
+                memcpy(obuf + opos, decoder->obuf, olen);
+            }
+        }
+        if (olen < 0 || (dlen >= 0 && olen != dlen)) {
+            return ZLING_ERROR;
+        }
+        ipos += size;
+        opos += olen;
+    }
+    *dstlen = opos;
+    return ZLING_OK;
+}
+
+int zling_decoder_process(zling_decoder* decoder,
+                          const void* src, size_t* srclen,
+                          void* dst, size_t* dstlen,
+                          int finish) {
+    const unsigned char* ibuf = static_cast<const unsigned char*>(src);
+    unsigned char* obuf = static_cast<unsigned char*>(dst);
+    size_t ipos = 0;
+    size_t opos = 0;
+
+    if (ReserveInput(decoder) != ZLING_OK || ReserveOutput(decoder) != ZLING_OK) {
+        return ZLING_MEM_ERROR;
+    }
+
+    while (true) {
+        // drain decoded round
+        int n = Min<size_t>(decoder->olen - decoder->opos, *dstlen - opos);
+        memcpy(obuf + opos, decoder->obuf + decoder->opos, n);
+        decoder->opos += n;
+        opos += n;
+        if (decoder->opos < decoder->olen) {
+            break;
+        }
+
+        // stage next round, only as many bytes as needed
+        bool eof = finish && ipos == *srclen;
+        if (decoder->ilen == 0 && (eof || ipos == *srclen)) {
+            decoder->finished = eof;
+            break;
+        }
+        int need;
+        int hlen;
+        int dlen;
+
+        // window frame: only at stream start, buffers are grown before the first round is staged
+        if (decoder->window == 0) {
+            if (decoder->ilen < kWindowHeaderSize && (decoder->ilen == 0 || decoder->ibuf[0] == kFlagWindow) && !eof) {
+                if (ipos == *srclen) {
+                    break;
+                }
+                n = Min<size_t>(kWindowHeaderSize - decoder->ilen, *srclen - ipos);
+                memcpy(decoder->ibuf + decoder->ilen, ibuf + ipos, n);
+                decoder->ilen += n;
+                ipos += n;
+                continue;
+            }
+            int window = ZlingReadWindow(decoder->ibuf, decoder->ilen);
+            if (window == -1) {
+                return ZLING_ERROR;
+            }
+            if (SetWindow(decoder, window) != ZLING_OK || ReserveOutput(decoder) != ZLING_OK) {
+                return ZLING_MEM_ERROR;
+            }
+        }
+        int size = ZlingParseRound(decoder->ibuf, decoder->ilen, eof, &need, &hlen, &dlen, decoder->window);
+
+        if (size == -1) {
+            return ZLING_ERROR;
+        }
+        if (size == 0) {
+            if (ipos == *srclen) {
+                break;
+            }
+            n = Min<size_t>(need - decoder->ilen, *srclen - ipos);
+            memcpy(decoder->ibuf + decoder->ilen, ibuf + ipos, n);
+            decoder->ilen += n;
+            ipos += n;
+            continue;
+        }
+
+        // sink: blocks are passed while decoding, nothing is left to drain
+        decoder->decoder->SetSink((decoder->sink != NULL) ? PassToSink : NULL, decoder);
+        decoder->olen = decoder->decoder->Decode(decoder->ibuf + hlen, size - hlen, decoder->obuf, decoder->window);
+        decoder->decoder->SetSink(NULL, NULL);
+        decoder->opos = (decoder->sink != NULL) ? decoder->olen : 0;
+        if (decoder->olen < 0 || (dlen >= 0 && decoder->olen != dlen)) {
+            decoder->olen = 0;
+            return ZLING_ERROR;
+        }
+        memmove(decoder->ibuf, decoder->ibuf + size, decoder->ilen - size);
+        decoder->ilen -= size;
+    }
+    *srclen = ipos;
+    *dstlen = opos;
+    return decoder->finished ? ZLING_STREAM_END : ZLING_OK;
+}
+
+int zling_decoder_decompress_range(zling_decoder* decoder,
+                                   const void* src, size_t srclen,
+                                   uint64_t offset,
+                                   void* dst, size_t* dstlen) {
+    const unsigned char* ibuf = static_cast<const unsigned char*>(src);
+    unsigned char* obuf = static_cast<unsigned char*>(dst);
+    std::vector<ZlingIndexEntry> index;
+    size_t opos = 0;
+    int window = ZlingReadWindow(ibuf, Min<size_t>(srclen, kWindowHeaderSize));
+
+    if (window == -1) {
+        return ZLING_ERROR;
+    }
+    if (SetWindow(decoder, window) != ZLING_OK) {
+        return ZLING_MEM_ERROR;
+    }
+
+    // load index from the end of stream
+    if (srclen < size_t(kIndexTrailerSize)) {
+        return ZLING_ERROR;
+    }
+    int index_size = ZlingReadIndexSize(ibuf + srclen - kIndexTrailerSize);
+    if (index_size == -1 || size_t(index_size) > srclen) {
+        return ZLING_ERROR;
+    }
+    if (ZlingReadIndex(ibuf + srclen - index_size, index_size, &index, window) == -1) {
+        return ZLING_ERROR;
+    }
+
+    // decode overlapping rounds, after the window frame if any
+    uint64_t round_ipos = (srclen > 0 && ibuf[0] == kFlagWindow) ? kWindowHeaderSize : 0;
+    uint64_t round_opos = 0;
+
+    for (size_t i = 0; i < index.size() && opos < *dstlen; i++) {
+        uint64_t round_end = round_opos + index[i].dlen;
+
+        if (round_end > offset) {
+            int need;
+            int hlen;
+            int dlen;
+            size_t round_size = index[i].size;
+
+            if (round_ipos + round_size + index_size > srclen) {
+                return ZLING_ERROR;
+            }
+            if (ZlingParseRound(ibuf + round_ipos, round_size, true, &need, &hlen, &dlen, window) != int(round_size)
+                    || dlen != int(index[i].dlen)) {
+                return ZLING_ERROR;
+            }
+            if (ReserveOutput(decoder) != ZLING_OK) {
+                return ZLING_MEM_ERROR;
+            }
+
+            // round is followed by at least the index trailer, so reading 16 bytes beyond is safe
+            size_t from = offset > round_opos ? offset - round_opos : 0;
+            size_t stop = Min<uint64_t>(from + (*dstlen - opos), dlen);
+            int olen = decoder->decoder->Decode(
+                ibuf + round_ipos + hlen, round_size - hlen, decoder->obuf, window, stop);
+            if (olen < int(stop)) {
+                return ZLING_ERROR;
+            }
+            memcpy(obuf + opos, decoder->obuf + from, stop - from);
+            opos += stop - from;
+        }
+        round_ipos += index[i].size;
+        round_opos = round_end;
+    }
+    *dstlen = opos;
+    return ZLING_OK;
+}
+
+int zling_decompress_range(const void* src, size_t srclen, uint64_t offset, void* dst, size_t* dstlen) {
+    zling_decoder* decoder = zling_decoder_create();
+    if (decoder == NULL) {
+        return ZLING_MEM_ERROR;
+    }
+    int ret = zling_decoder_decompress_range(decoder, src, srclen, offset, dst, dstlen);
+    zling_decoder_destroy(decoder);
+    return ret;
+}
+
+// dictionary
+// ============================================================
+int zling_train_dictionary(const void* samples, const size_t* sizes, size_t nsamples, void* dict, size_t* dictlen) {
+    std::vector<int> isizes(nsamples);
+    size_t total = 0;
+
+    if (nsamples == 0 || dict == NULL) {
+        return ZLING_ERROR;
+    }
+    for (size_t i = 0; i < nsamples; i++) {
+        if (sizes[i] > size_t(kBlockSizeIn) || (total += sizes[i]) > size_t(kBlockSizeIn) * 64) {
+            return ZLING_ERROR;  // positions of samples must fit in int
+        }
+        isizes[i] = sizes[i];
+    }
+    try {
+        *dictlen = ZlingTrainDictionary(static_cast<const unsigned char*>(samples),
+                                        &isizes[0],
+                                        nsamples,
+                                        static_cast<unsigned char*>(dict),
+                                        Min<size_t>(*dictlen, kDictMaxSize));
+    } catch (...) {
+        return ZLING_MEM_ERROR;
+    }
+    return ZLING_OK;
+}
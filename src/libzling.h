@@ -0,0 +1,142 @@
+/**
+ * zling:
+ *  light-weight lossless data compression utility.
+ *
+ * Copyright (C) 2012-2013 by Zhang Li <zhangli10 at baidu.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * @author zhangli10<zhangli10@baidu.com>
+ * @brief  libzling: in-memory compression API (C ABI).
+ */
+#ifndef SRC_LIBZLING_H
+#define SRC_LIBZLING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ZLING_OK          0
+#define ZLING_STREAM_END  1
+#define ZLING_ERROR      -1  /* invalid argument or corrupted data */
+#define ZLING_BUF_ERROR  -2  /* output buffer too small */
+#define ZLING_MEM_ERROR  -3  /* out of memory */
+
+/* encoder options */
+#define ZLING_OPTION_SEEKABLE  1  /* append a round index for range decoding, default 0 */
+#define ZLING_OPTION_LEVEL     2  /* compression level 1 (fastest) .. 9 (best), default 5 */
+#define ZLING_OPTION_CHECKSUM  3  /* store crc32c of each round, verified when decoding, default 0 */
+#define ZLING_OPTION_PIPELINE  4  /* huffman-code in a second thread while rolz goes on, default 0 */
+
+/* contexts own all their buffers. a context must not be used by two threads at the same time,
+ * different contexts can be used concurrently. decoders size their buffers from the window frame
+ * of a stream ('zling e -W', up to 256MB rounds), 16MB otherwise. */
+typedef struct zling_encoder zling_encoder;
+typedef struct zling_decoder zling_decoder;
+
+/* zling_sink: receives decoded data, in order, see zling_decoder_set_sink(). */
+typedef void (*zling_sink)(const void* data, size_t len, void* arg);
+
+/* zling_compress_bound: max compressed size of srclen bytes. */
+size_t zling_compress_bound(size_t srclen);
+
+/* zling_compress/zling_decompress: buffer-to-buffer (de)compression with a temporary context.
+ *  *dstlen: capacity of dst on input, output size on return. */
+int zling_compress(const void* src, size_t srclen, void* dst, size_t* dstlen);
+int zling_decompress(const void* src, size_t srclen, void* dst, size_t* dstlen);
+
+zling_encoder* zling_encoder_create(void);
+void zling_encoder_destroy(zling_encoder* encoder);
+void zling_encoder_reset(zling_encoder* encoder);
+
+/* zling_encoder_set_option: set an encoder option (ZLING_OPTION_*), before compressing a stream. */
+int zling_encoder_set_option(zling_encoder* encoder, int option, int value);
+
+/* zling_encoder_set_dictionary: prime every round with dict (copied, at most 1MB), the same
+ *  dictionary must be set on the decoder. dict == NULL removes it. */
+int zling_encoder_set_dictionary(zling_encoder* encoder, const void* dict, size_t dictlen);
+
+/* zling_encoder_compress: same as zling_compress(), reusing the context. */
+int zling_encoder_compress(zling_encoder* encoder, const void* src, size_t srclen, void* dst, size_t* dstlen);
+
+/* zling_encoder_process: streaming compression.
+ *  *srclen: available input on input, consumed input on return.
+ *  *dstlen: available output on input, produced output on return.
+ *  finish:  non-zero if no more input follows src.
+ *  return:  ZLING_STREAM_END when finished and all output is produced,
+ *           ZLING_OK when more calls are needed, or a negative error code. */
+int zling_encoder_process(zling_encoder* encoder,
+                          const void* src, size_t* srclen,
+                          void* dst, size_t* dstlen,
+                          int finish);
+
+zling_decoder* zling_decoder_create(void);
+void zling_decoder_destroy(zling_decoder* decoder);
+void zling_decoder_reset(zling_decoder* decoder);
+
+/* zling_decoder_set_dictionary: dictionary for streams compressed with one. */
+int zling_decoder_set_dictionary(zling_decoder* decoder, const void* dict, size_t dictlen);
+
+/* zling_decoder_set_sink: zling_decoder_process() passes decoded data to sink block by block, as soon
+ *  as it is final, instead of copying whole rounds to dst (*dstlen returns 0). rounds with a checksum
+ *  are passed at once after it is verified. data of a round found corrupted otherwise may have been
+ *  passed before ZLING_ERROR is returned. sink == NULL restores output to dst. */
+int zling_decoder_set_sink(zling_decoder* decoder, zling_sink sink, void* arg);
+
+/* zling_decoder_decompress: same as zling_decompress(), reusing the context. */
+int zling_decoder_decompress(zling_decoder* decoder, const void* src, size_t srclen, void* dst, size_t* dstlen);
+
+/* zling_decoder_process: streaming decompression, same convention as zling_encoder_process(). */
+int zling_decoder_process(zling_decoder* decoder,
+                          const void* src, size_t* srclen,
+                          void* dst, size_t* dstlen,
+                          int finish);
+
+/* zling_decoder_decompress_range: decode bytes [offset, offset + *dstlen) of a seekable stream,
+ *  only rounds overlapping the range are decoded.
+ *  *dstlen: number of bytes wanted on input, number of bytes produced on return
+ *           (less than wanted if the range exceeds the end of data). */
+int zling_decoder_decompress_range(zling_decoder* decoder,
+                                   const void* src, size_t srclen,
+                                   uint64_t offset,
+                                   void* dst, size_t* dstlen);
+
+/* zling_decompress_range: same as zling_decoder_decompress_range() with a temporary context. */
+int zling_decompress_range(const void* src, size_t srclen, uint64_t offset, void* dst, size_t* dstlen);
+
+/* zling_train_dictionary: build a dictionary from sample records.
+ *  samples:  all samples, concatenated
+ *  sizes:    size of each sample
+ *  *dictlen: max dictionary size on input (at most 1MB), dictionary size on return. */
+int zling_train_dictionary(const void* samples, const size_t* sizes, size_t nsamples, void* dict, size_t* dictlen);
+
+#ifdef __cplusplus
+}
+#endif
+#endif  // SRC_LIBZLING_H
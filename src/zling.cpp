@@ -32,10 +32,13 @@
  * @author zhangli10<zhangli10@baidu.com>
  * @brief  zling main.
  */
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <ctime>
+#include <pthread.h>
+#include <sys/time.h>
+#include <vector>
 
 #if HAS_CXX11_SUPPORT
 #include <cstdint>
@@ -47,205 +50,495 @@
 #if defined(__MINGW32__) || defined(__MINGW64__)
 #include <fcntl.h>  // setmode()
 #include <io.h>
+#else
+#define ZLING_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
-#include "src/zling_codebuf.h"
-#include "src/zling_huffman.h"
-#include "src/zling_lz.h"
-
-using baidu::zling::codebuf::ZlingCodebuf;
-using baidu::zling::huffman::ZlingMakeLengthTable;
-using baidu::zling::huffman::ZlingMakeEncodeTable;
-using baidu::zling::huffman::ZlingMakeDecodeTable;
-using baidu::zling::lz::ZlingRolzEncoder;
-using baidu::zling::lz::ZlingRolzDecoder;
-
-using baidu::zling::lz::kMatchMaxLen;
-using baidu::zling::lz::kMatchMinLen;
-using baidu::zling::lz::kBucketItemSize;
-
-static inline double GetTimeCost(clock_t clock_start) {
-    return 1.0 * (clock() - clock_start) / CLOCKS_PER_SEC;
-}
-
-static const unsigned char matchidx_bitlen[] = {
-    /* 0 */ 0, 0, 0, 0,
-    /* 4 */ 1, 1,
-    /* 6 */ 2, 2,
-    /* 8 */ 3, 3,
-    /* 10*/ 4, 4,
-    /* 12*/ 5, 5,
-    /* 14*/ 6, 6,
-    /* 16*/ 7, 7,
-    /* 18*/ 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
-    /* 32*/
+#include "src/zling_codec.h"
+#include "src/zling_dict.h"
+
+using baidu::zling::codec::ZlingRoundEncoder;
+using baidu::zling::codec::ZlingRoundDecoder;
+using baidu::zling::codec::ZlingIndexEntry;
+using baidu::zling::codec::ZlingIndexSize;
+using baidu::zling::codec::ZlingWriteIndex;
+using baidu::zling::codec::ZlingReadIndexSize;
+using baidu::zling::codec::ZlingReadIndex;
+using baidu::zling::codec::ZlingParseRound;
+using baidu::zling::codec::ZlingRoundOutSize;
+using baidu::zling::codec::ZlingWriteWindow;
+using baidu::zling::codec::ZlingReadWindow;
+
+using baidu::zling::dict::ZlingTrainDictionary;
+using baidu::zling::dict::kDictMaxSize;
+using baidu::zling::dict::kDictDefaultSize;
+
+using baidu::zling::lz::kMinLevel;
+using baidu::zling::lz::kMaxLevel;
+using baidu::zling::lz::kDefaultLevel;
+
+using baidu::zling::codec::kBlockSizeIn;
+using baidu::zling::codec::kBlockSizeHuffman;
+using baidu::zling::codec::kBlockSizeOut;
+using baidu::zling::codec::kFlagRoundStart;
+using baidu::zling::codec::kFlagRoundBlock;
+using baidu::zling::codec::kFlagRoundSized;
+using baidu::zling::codec::kRoundHeaderSize;
+using baidu::zling::codec::kBlockHeaderSize;
+using baidu::zling::codec::kFlagIndex;
+using baidu::zling::codec::kFlagWindow;
+using baidu::zling::codec::kWindowHeaderSize;
+using baidu::zling::codec::kWindowSizeMax;
+using baidu::zling::codec::kIndexHeaderSize;
+using baidu::zling::codec::kIndexTrailerSize;
+using baidu::zling::codec::kIndexMaxRounds;
+using baidu::zling::codec::ZlingBlockStats;
+using baidu::zling::codec::kFlagRoundBlockStatic;
+using baidu::zling::codec::kFlagRoundBlockRepeat;
+using baidu::zling::codec::kFlagRoundBlockStored;
+
+static const int kMaxThreads = 64;
+
+struct ZlingOptions {
+    int      level;         // -1 .. -9: compression level
+    int      nthreads;      // -T: encode/decode rounds in parallel
+    int      window;        // -W: round size (large window), kBlockSizeIn by default
+    bool     seekable;      // -s: append round index
+    bool     checksum;      // -c: store crc32c of each round
+    bool     pipeline;      // -P: huffman stage of blocks in a second thread per round
+    bool     test;          // zling t: decode and verify only, no output
+    bool     range;         // -R: decode range only
+    uint64_t range_offset;
+    uint64_t range_length;
+    std::vector<unsigned char> dict;  // -D: prime rounds with a dictionary
+    const char* stats;                // --stats: write per-block statistics (JSON) to this file
 };
-static const int kMatchidxCodeSymbols = sizeof(matchidx_bitlen) / sizeof(matchidx_bitlen[0]);
-static const int kMatchidxMaxBitlen = 8;
 
-static unsigned char matchidx_code[kBucketItemSize];
-static unsigned char matchidx_bits[kBucketItemSize];
-static uint16_t      matchidx_base[kMatchidxCodeSymbols];
+static inline double GetTimeStart() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+static inline double GetTimeCost(double time_start) {  // wall time, threads make clock() meaningless
+    return GetTimeStart() - time_start;
+}
+
+// LoadFile: read a whole file into data, at most maxlen bytes.
+static int LoadFile(const char* path, int maxlen, std::vector<unsigned char>* data) {
+    FILE* fp = fopen(path, "rb");
+    unsigned char buf[65536];
+    size_t len;
 
-static inline void InitMatchidxCode() {
-    int code = 0;
-    int bits = 0;
+    if (fp == NULL) {
+        fprintf(stderr, "error: cannot open file '%s' for read.\n", path);
+        return -1;
+    }
+    data->clear();
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        if (data->size() + len > size_t(maxlen)) {
+            fprintf(stderr, "error: file '%s' is too large.\n", path);
+            fclose(fp);
+            return -1;
+        }
+        data->insert(data->end(), buf, buf + len);
+    }
+    fclose(fp);
+    return 0;
+}
 
-    for (int i = 0; i < kBucketItemSize; i++) {
-        matchidx_code[i] = code;
-        matchidx_bits[i] = bits;
+// ZlingWorker: runs one job at a time in its own thread (or inline when not threaded),
+//  jobs are submitted and waited in round order, so output order is kept.
+struct ZlingWorker {
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    bool            threaded;
+    bool            busy;
+    bool            quit;
+    void          (*job)(ZlingWorker*);
 
-        if (i + 1 < kBucketItemSize && (++bits) >> matchidx_bitlen[code] != 0) {
-            bits = 0;
-            matchidx_base[++code] = i + 1;
+    // job data: encode ibuf (data) to obuf (round), or decode ibuf (round body) to obuf (data)
+    //  ibuf/obuf point to the worker's own buffers, or into mapped source/target files.
+    ZlingRoundEncoder* encoder;
+    ZlingRoundDecoder* decoder;
+    unsigned char*     ibuf;
+    unsigned char*     obuf;
+    unsigned char*     ibuf_owned;
+    unsigned char*     obuf_owned;
+    struct ZlingInput* input;  // reader: buffered stdin
+    int                window;  // reader: max round size
+    int                ilen;
+    int                olen;
+    int                ocap;
+    int                dlen;  // decoded size from the round header, -1 if unknown (legacy round)
+};
+
+static void* WorkerThread(void* arg) {
+    ZlingWorker* worker = static_cast<ZlingWorker*>(arg);
+
+    pthread_mutex_lock(&worker->mutex);
+    while (true) {
+        while (!worker->busy && !worker->quit) {
+            pthread_cond_wait(&worker->cond, &worker->mutex);
+        }
+        if (!worker->busy) {
+            break;
         }
+        pthread_mutex_unlock(&worker->mutex);
+        worker->job(worker);
+        pthread_mutex_lock(&worker->mutex);
+
+        worker->busy = false;
+        pthread_cond_broadcast(&worker->cond);
+    }
+    pthread_mutex_unlock(&worker->mutex);
+    return NULL;
+}
+
+static int StartWorker(ZlingWorker* worker, bool threaded) {
+    worker->threaded = threaded;
+    worker->busy = false;
+    worker->quit = false;
+    pthread_mutex_init(&worker->mutex, NULL);
+    pthread_cond_init(&worker->cond, NULL);
+
+    if (threaded && pthread_create(&worker->thread, NULL, WorkerThread, worker) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void SubmitWorker(ZlingWorker* worker, void (*job)(ZlingWorker*)) {
+    worker->job = job;
+    if (!worker->threaded) {
+        job(worker);
+        return;
+    }
+    pthread_mutex_lock(&worker->mutex);
+    worker->busy = true;
+    pthread_cond_broadcast(&worker->cond);
+    pthread_mutex_unlock(&worker->mutex);
+    return;
+}
+
+static void WaitWorker(ZlingWorker* worker) {
+    if (!worker->threaded) {
+        return;
     }
+    pthread_mutex_lock(&worker->mutex);
+    while (worker->busy) {
+        pthread_cond_wait(&worker->cond, &worker->mutex);
+    }
+    pthread_mutex_unlock(&worker->mutex);
     return;
 }
 
-static inline uint32_t IdxToCode(uint32_t idx) {
-    return matchidx_code[idx];
+static void StopWorker(ZlingWorker* worker) {
+    if (worker->threaded) {
+        pthread_mutex_lock(&worker->mutex);
+        worker->quit = true;
+        pthread_cond_broadcast(&worker->cond);
+        pthread_mutex_unlock(&worker->mutex);
+        pthread_join(worker->thread, NULL);
+    }
+    pthread_mutex_destroy(&worker->mutex);
+    pthread_cond_destroy(&worker->cond);
+    return;
 }
-static inline uint32_t IdxToBits(uint32_t idx) {
-    return matchidx_bits[idx];
+
+// I/O workers: a reader prefetches the next input while the current one is (de)compressed, and a
+//  writer drains finished output meanwhile, so I/O and CPU overlap even with a single worker.
+//  buffers are handed over by swapping them with a worker's, after both are idle.
+static void WriteJob(ZlingWorker* io) {
+    fwrite(io->obuf, 1, io->olen, stdout);
+    return;
 }
-static inline uint32_t IdxToBitlen(uint32_t idx) {
-    return matchidx_bitlen[matchidx_code[idx]];
+
+static void SwapInput(ZlingWorker* worker, ZlingWorker* io) {
+    std::swap(worker->ibuf, io->ibuf);
+    std::swap(worker->ibuf_owned, io->ibuf_owned);
+    return;
+}
+
+static void SwapOutput(ZlingWorker* worker, ZlingWorker* io) {
+    std::swap(worker->obuf, io->obuf);
+    std::swap(worker->obuf_owned, io->obuf_owned);
+    return;
 }
 
-static inline uint32_t IdxBitlenFromCode(uint32_t code) {
-    return matchidx_bitlen[code];
+/* StartIOWorker: start a reader/writer thread with its own buffers.
+ *  arg isize:  input buffer size (0 for none)
+ *  arg osize:  output buffer size (0 for none)
+ */
+static int StartIOWorker(ZlingWorker* io, int isize, int osize) {
+    io->ibuf_owned = (isize > 0) ? new unsigned char[isize] : NULL;
+    io->obuf_owned = (osize > 0) ? new unsigned char[osize] : NULL;
+    io->ibuf = io->ibuf_owned;
+    io->obuf = io->obuf_owned;
+    io->ilen = 0;
+    io->olen = 0;
+    io->input = NULL;
+    io->window = kBlockSizeIn;
+    return StartWorker(io, true);
 }
-static inline uint32_t IdxFromCodeBits(uint32_t code, uint32_t bits) {
-    return matchidx_base[code] | bits;
+
+static void StopIOWorker(ZlingWorker* io) {
+    WaitWorker(io);
+    StopWorker(io);
+    delete [] io->ibuf_owned;
+    delete [] io->obuf_owned;
+    return;
 }
 
-static const int kHuffmanCodes1      = 256 + (kMatchMaxLen - kMatchMinLen + 1);  // must be even
-static const int kHuffmanCodes2      = kMatchidxCodeSymbols;                     // must be even
-static const int kHuffmanMaxLen1     = 15;
-static const int kHuffmanMaxLen2     = 8;
-static const int kHuffmanMaxLen1Fast = 10;
+// ZlingMapping: a whole regular file mapped into memory, for zero-copy file-to-file (de)compression.
+struct ZlingMapping {
+    unsigned char* data;
+    uint64_t       size;
+};
+
+// MapFile: map fp (must be at offset 0), or resize it to size and map writable (must be an empty
+//  file opened for reading and writing, not appending).
+//  return: false if fp cannot be mapped (pipes, terminals, empty files, ...), use stdio then.
+static bool MapFile(FILE* fp, bool writable, uint64_t size, ZlingMapping* mapping) {
+#if ZLING_HAS_MMAP
+    struct stat st;
+    int fd = fileno(fp);
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || lseek(fd, 0, SEEK_CUR) != 0) {
+        return false;
+    }
+    if (writable && ((fcntl(fd, F_GETFL) & (O_ACCMODE | O_APPEND)) != O_RDWR || st.st_size != 0)) {
+        return false;  // '>> file', '> file' or existing data: leave the file to stdio
+    }
+    if (writable && ftruncate(fd, size) != 0) {
+        return false;
+    }
+    size = writable ? size : st.st_size;
+    if (size == 0 || size != uint64_t(size_t(size))) {
+        return false;
+    }
+    void* data = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+    mapping->data = static_cast<unsigned char*>(data);
+    mapping->size = size;
+    return true;
+#else
+    return false;
+#endif
+}
+
+static void UnmapFile(ZlingMapping* mapping) {
+#if ZLING_HAS_MMAP
+    munmap(mapping->data, mapping->size);
+#endif
+    return;
+}
+
+// WriteBlockStats: write stats fields of a block (or of the sum of all blocks) as JSON members.
+static void WriteBlockStats(FILE* fp, const ZlingBlockStats& stats, const char* indent) {
+    int tokens = stats.literals + stats.matches;
+
+    fprintf(fp, "%s\"input_bytes\": %d,\n", indent, stats.ilen);
+    fprintf(fp, "%s\"encoded_bytes\": %d,\n", indent, stats.olen);
+    fprintf(fp, "%s\"symbols\": %d,\n", indent, stats.symbols);
+    fprintf(fp, "%s\"literals\": %d,\n", indent, stats.literals);
+    fprintf(fp, "%s\"matches\": %d,\n", indent, stats.matches);
+    fprintf(fp, "%s\"literal_ratio\": %.4f,\n", indent, tokens > 0 ? 1.0 * stats.literals / tokens : 0);
+    fprintf(fp, "%s\"avg_match_len\": %.2f,\n", indent, stats.matches > 0 ? 1.0 * stats.match_bytes / stats.matches : 0);
+    fprintf(fp, "%s\"match_calls\": %llu,\n", indent, static_cast<unsigned long long>(stats.rolz.match_calls));
+    fprintf(fp, "%s\"chain_nodes\": %llu,\n", indent, static_cast<unsigned long long>(stats.rolz.chain_nodes));
+    fprintf(fp, "%s\"avg_chain_depth\": %.2f,\n",
+            indent, stats.rolz.match_calls > 0 ? 1.0 * stats.rolz.chain_nodes / stats.rolz.match_calls : 0);
+    fprintf(fp, "%s\"check_rejects\": %llu,\n", indent, static_cast<unsigned long long>(stats.rolz.check_rejects));
+    fprintf(fp, "%s\"discards\": %llu,\n", indent, static_cast<unsigned long long>(stats.rolz.discards));
+    fprintf(fp, "%s\"table_bits\": %llu,\n", indent, static_cast<unsigned long long>(stats.table_bits));
+    fprintf(fp, "%s\"payload_bits\": %llu,\n", indent, static_cast<unsigned long long>(stats.payload_bits));
+    fprintf(fp, "%s\"rolz_time\": %.6f,\n", indent, stats.times.rolz);
+    fprintf(fp, "%s\"huffman_time\": %.6f\n", indent, stats.times.huffman);
+    return;
+}
+
+static void AddBlockStats(ZlingBlockStats* total, const ZlingBlockStats& stats) {
+    total->ilen += stats.ilen;
+    total->olen += stats.olen;
+    total->symbols += stats.symbols;
+    total->literals += stats.literals;
+    total->matches += stats.matches;
+    total->match_bytes += stats.match_bytes;
+    total->table_bits += stats.table_bits;
+    total->payload_bits += stats.payload_bits;
+    total->rolz.match_calls += stats.rolz.match_calls;
+    total->rolz.chain_nodes += stats.rolz.chain_nodes;
+    total->rolz.check_rejects += stats.rolz.check_rejects;
+    total->rolz.discards += stats.rolz.discards;
+    total->times.rolz += stats.times.rolz;
+    total->times.huffman += stats.times.huffman;
+    return;
+}
 
-static const int kBlockSizeIn      = 16777216;
-static const int kBlockSizeRolz    = 262144;
-static const int kBlockSizeHuffman = 393216;
+static void EncodeJob(ZlingWorker* worker) {
+    worker->olen = worker->encoder->Encode(worker->ibuf, worker->ilen, worker->obuf);
+    return;
+}
 
-static unsigned char ibuf[kBlockSizeIn];
-static unsigned char obuf[kBlockSizeHuffman + 16];  // avoid overflow on decoding
-static uint16_t      tbuf[kBlockSizeRolz];
+static void ReadDataJob(ZlingWorker* io) {
+    io->ilen = fread(io->ibuf, 1, io->window, stdin);
+    return;
+}
 
-static int main_encode() {
-    ZlingRolzEncoder* lzencoder = new ZlingRolzEncoder();
+static int main_encode(const ZlingOptions& options) {
+    int nthreads = options.nthreads;
+    int window = options.window;
+    ZlingWorker* workers = new ZlingWorker[nthreads];
+    std::vector<ZlingIndexEntry> index;
+    ZlingMapping src;
+    bool src_mapped = MapFile(stdin, false, 0, &src);  // encode straight from the mapped source
+    uint64_t src_pos = 0;
     uint64_t size_src = 0;
     uint64_t size_dst = 0;
-    int ilen = 0;
-    int rlen = 0;
-    int olen = 0;
-    clock_t clock_start = clock();
-
-    InitMatchidxCode();
-
-    while ((ilen = fread(ibuf, 1, kBlockSizeIn, stdin)) > 0) {
-        fputc(0, stdout);  // flag: start rolz round
-        size_dst += 1;
-        size_src += ilen;
-
-        int encpos = 0;
-        lzencoder->Reset();
-
-        while (encpos < ilen) {
-            fputc(1, stdout);  // flag: continue rolz round
-            size_dst += 1;
-
-            // ROLZ encode
-            // ============================================================
-            rlen = lzencoder->Encode(ibuf, tbuf, ilen, kBlockSizeRolz, &encpos);
-
-            // HUFFMAN encode
-            // ============================================================
-            ZlingCodebuf codebuf;
-            int opos = 0;
-            uint32_t freq_table1[kHuffmanCodes1] = {0};
-            uint32_t freq_table2[kHuffmanCodes2] = {0};
-            uint32_t length_table1[kHuffmanCodes1];
-            uint32_t length_table2[kHuffmanCodes2];
-            uint16_t encode_table1[kHuffmanCodes1];
-            uint16_t encode_table2[kHuffmanCodes2];
-
-            for (int i = 0; i < rlen; i++) {
-                freq_table1[tbuf[i]] += 1;
-                if (tbuf[i] >= 256) {
-                    freq_table2[IdxToCode(tbuf[++i])] += 1;
-                }
-            }
-            ZlingMakeLengthTable(freq_table1, length_table1, 0, kHuffmanCodes1, kHuffmanMaxLen1);
-            ZlingMakeLengthTable(freq_table2, length_table2, 0, kHuffmanCodes2, kHuffmanMaxLen2);
+    double time_start = GetTimeStart();
+    FILE* stats_fp = NULL;
+    ZlingBlockStats stats_total = ZlingBlockStats();
+    int stats_blocks = 0;
 
-            ZlingMakeEncodeTable(length_table1, encode_table1, kHuffmanCodes1, kHuffmanMaxLen1);
-            ZlingMakeEncodeTable(length_table2, encode_table2, kHuffmanCodes2, kHuffmanMaxLen2);
+    if (options.stats != NULL) {
+        if ((stats_fp = fopen(options.stats, "w")) == NULL) {
+            fprintf(stderr, "error: cannot open file '%s' for write.\n", options.stats);
+            return -1;
+        }
+        fprintf(stats_fp, "{\n  \"blocks\": [\n");
+    }
 
-            // write length table
-            for (int i = 0; i < kHuffmanCodes1; i += 2) {
-                obuf[opos++] = length_table1[i] * 16 + length_table1[i + 1];
-            }
-            for (int i = 0; i < kHuffmanCodes2; i += 2) {
-                obuf[opos++] = length_table2[i] * 16 + length_table2[i + 1];
-            }
-            if (opos % 4 != 0) obuf[opos++] = 0;  // keep aligned
-            if (opos % 4 != 0) obuf[opos++] = 0;  // keep aligned
-            if (opos % 4 != 0) obuf[opos++] = 0;  // keep aligned
-            if (opos % 4 != 0) obuf[opos++] = 0;  // keep aligned
-
-            // encode
-            for (int i = 0; i < rlen; i++) {
-                codebuf.Input(encode_table1[tbuf[i]], length_table1[tbuf[i]]);
-                if (tbuf[i] >= 256) {
-                    i++;
-                    codebuf.Input(
-                        encode_table2[IdxToCode(tbuf[i])],
-                        length_table2[IdxToCode(tbuf[i])]);
-                    codebuf.Input(
-                        IdxToBits(tbuf[i]),
-                        IdxToBitlen(tbuf[i]));
-                }
-                while (codebuf.GetLength() >= 32) {
-#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-                    *reinterpret_cast<uint32_t*>(obuf + opos) = codebuf.Output(32);
-                    opos += 4;
-#else
-                    obuf[opos++] = codebuf.Output(8);
-                    obuf[opos++] = codebuf.Output(8);
-                    obuf[opos++] = codebuf.Output(8);
-                    obuf[opos++] = codebuf.Output(8);
-#endif
-                }
+    ZlingWorker reader;
+    ZlingWorker writer;
+
+    if (StartIOWorker(&reader, src_mapped ? 0 : window, 0) == -1
+            || StartIOWorker(&writer, 0, ZlingRoundOutSize(window)) == -1) {
+        fprintf(stderr, "error: cannot create I/O thread.\n");
+        return -1;
+    }
+    if (!src_mapped) {
+        reader.window = window;
+        SubmitWorker(&reader, ReadDataJob);
+    }
+    if (window != kBlockSizeIn) {  // large window: tell decoders the round size first
+        unsigned char header[kWindowHeaderSize] = {0};
+        size_dst += fwrite(header, 1, ZlingWriteWindow(window, header), stdout);
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        workers[i].encoder = new ZlingRoundEncoder();
+        workers[i].encoder->SetLevel(options.level);
+        workers[i].encoder->SetChecksum(options.checksum);
+        workers[i].encoder->SetPipeline(options.pipeline);
+        if (!options.dict.empty()) {
+            workers[i].encoder->SetDictionary(&options.dict[0], options.dict.size());
+        }
+        workers[i].ibuf_owned = src_mapped ? NULL : new unsigned char[window];
+        workers[i].obuf_owned = new unsigned char[ZlingRoundOutSize(window)];
+        workers[i].ibuf = workers[i].ibuf_owned;
+        workers[i].obuf = workers[i].obuf_owned;
+        workers[i].ilen = 0;
+        workers[i].olen = 0;
+        if (StartWorker(&workers[i], nthreads > 1) == -1) {
+            fprintf(stderr, "error: cannot create worker thread.\n");
+            return -1;
+        }
+    }
+
+    // round r is encoded by workers[r % nthreads], after round (r - nthreads) is written out.
+    for (int round = 0, eof = 0, pending = 0; !eof || pending > 0; round++) {
+        ZlingWorker* worker = &workers[round % nthreads];
+
+        if (worker->ilen > 0) {
+            WaitWorker(worker);
+            WaitWorker(&writer);
+            SwapOutput(worker, &writer);
+            writer.olen = worker->olen;
+            SubmitWorker(&writer, WriteJob);
+
+            ZlingIndexEntry entry = {uint32_t(worker->olen), uint32_t(worker->ilen)};
+            index.push_back(entry);
+            size_src += worker->ilen;
+            size_dst += worker->olen;
+            worker->ilen = 0;
+            pending--;
+
+            for (size_t i = 0; stats_fp != NULL && i < worker->encoder->GetBlockStats().size(); i++) {
+                const ZlingBlockStats& stats = worker->encoder->GetBlockStats()[i];
+                const char* type = (stats.flag == kFlagRoundBlockStatic) ? "static" :
+                                   (stats.flag == kFlagRoundBlockRepeat) ? "repeat" :
+                                   (stats.flag == kFlagRoundBlockStored) ? "stored" : "huffman";
+
+                fprintf(stats_fp, "%s    {\n", (stats_blocks++ > 0) ? ",\n" : "");
+                fprintf(stats_fp, "      \"round\": %d,\n", int(index.size()) - 1);
+                fprintf(stats_fp, "      \"block\": %d,\n", int(i));
+                fprintf(stats_fp, "      \"type\": \"%s\",\n", type);
+                WriteBlockStats(stats_fp, stats, "      ");
+                fprintf(stats_fp, "    }");
+                AddBlockStats(&stats_total, stats);
             }
-            while (codebuf.GetLength() > 0) {
-                obuf[opos++] = codebuf.Output(8);
+
+            fprintf(stderr, "%6.2f MB => %6.2f MB %.2f%%, %.3f sec, speed=%.3f MB/sec\n",
+                    size_src / 1e6,
+                    size_dst / 1e6,
+                    1e2 * size_dst / size_src, GetTimeCost(time_start),
+                    size_src / GetTimeCost(time_start) / 1e6);
+            fflush(stderr);
+        }
+        if (!eof && src_mapped) {
+            worker->ilen = (src.size - src_pos < uint64_t(window)) ? src.size - src_pos : window;
+            worker->ibuf = src.data + src_pos;
+            src_pos += worker->ilen;
+        } else if (!eof) {
+            WaitWorker(&reader);
+            SwapInput(worker, &reader);
+            worker->ilen = reader.ilen;
+            if (worker->ilen > 0) {
+                SubmitWorker(&reader, ReadDataJob);  // prefetch next round
             }
-            olen = opos;
-
-            // output
-            fputc(rlen / 16777216 % 256, stdout);
-            fputc(olen / 16777216 % 256, stdout);
-            fputc(rlen / 65536 % 256, stdout);
-            fputc(olen / 65536 % 256, stdout);
-            fputc(rlen / 256 % 256, stdout);
-            fputc(olen / 256 % 256, stdout);
-            fputc(rlen % 256, stdout);
-            fputc(olen % 256, stdout);
-            fwrite(obuf, 1, olen, stdout);
-            size_dst += 8;
-            size_dst += olen;
-        }
-        fprintf(stderr, "%6.2f MB => %6.2f MB %.2f%%, %.3f sec, speed=%.3f MB/sec\n",
-                size_src / 1e6,
-                size_dst / 1e6,
-                1e2 * size_dst / size_src, GetTimeCost(clock_start),
-                size_src / GetTimeCost(clock_start) / 1e6);
-        fflush(stderr);
-    }
-    delete lzencoder;
+        }
+        if (!eof && worker->ilen > 0) {
+            SubmitWorker(worker, EncodeJob);
+            pending++;
+        } else {
+            worker->ilen = 0;
+            eof = 1;
+        }
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        StopWorker(&workers[i]);
+        delete workers[i].encoder;
+        delete [] workers[i].ibuf_owned;
+        delete [] workers[i].obuf_owned;
+    }
+    delete [] workers;
+    StopIOWorker(&reader);
+    StopIOWorker(&writer);
+    if (src_mapped) {
+        UnmapFile(&src);
+    }
+
+    if (stats_fp != NULL) {
+        fprintf(stats_fp, "\n  ],\n  \"total\": {\n");
+        WriteBlockStats(stats_fp, stats_total, "    ");
+        fprintf(stats_fp, "  }\n}\n");
+        fclose(stats_fp);
+    }
+
+    if (options.seekable) {
+        std::vector<unsigned char> buf(ZlingIndexSize(index.size()));
+        fwrite(&buf[0], 1, ZlingWriteIndex(index, &buf[0]), stdout);
+        size_dst += buf.size();
+    }
 
     if (ferror(stdin) || ferror(stdout)) {
         fprintf(stderr, "error: I/O error.\n");
@@ -253,143 +546,364 @@ static int main_encode() {
     }
     fprintf(stderr,
             "\nencode: %llu => %llu, time=%.3f sec, speed=%.3f MB/sec\n",
-            size_src,
-            size_dst,
-            GetTimeCost(clock_start),
-            size_src / GetTimeCost(clock_start) / 1e6);
+            static_cast<unsigned long long>(size_src),
+            static_cast<unsigned long long>(size_dst),
+            GetTimeCost(time_start),
+            size_src / GetTimeCost(time_start) / 1e6);
     return 0;
 }
 
-static int main_decode() {
-    ZlingRolzDecoder* lzdecoder = new ZlingRolzDecoder();
+// WriteSink: streaming decode, each block goes to stdout as soon as it is decoded.
+static void WriteSink(const unsigned char* buf, int len, void*) {
+    fwrite(buf, 1, len, stdout);
+    fflush(stdout);
+    return;
+}
+
+static void DecodeJob(ZlingWorker* worker) {
+    worker->olen = worker->decoder->Decode(worker->ibuf, worker->ilen, worker->obuf, worker->ocap);
+    return;
+}
+
+// ZlingInput: buffered stdin for reading rounds, framing is parsed in memory and round bodies
+//  are read straight into place, bypassing the buffer.
+static const int kInputBufferSize = 65536;
+
+struct ZlingInput {
+    unsigned char buf[kInputBufferSize];
+    int pos;
+    int len;
+};
+
+// InputPeek: buffer at least n (<= kInputBufferSize) bytes if possible, return buffered length.
+static int InputPeek(ZlingInput* in, int n) {
+    if (in->len - in->pos < n) {
+        memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+        in->len -= in->pos;
+        in->pos = 0;
+        in->len += fread(in->buf + in->len, 1, kInputBufferSize - in->len, stdin);
+    }
+    return in->len - in->pos;
+}
+
+// InputRead: read n bytes into buf, buffered bytes first.
+static bool InputRead(ZlingInput* in, unsigned char* buf, int n) {
+    int len = std::min(n, in->len - in->pos);
+
+    memcpy(buf, in->buf + in->pos, len);
+    in->pos += len;
+    return len == n || fread(buf + len, 1, n - len, stdin) == size_t(n - len);
+}
+
+// InputSkip: skip n bytes.
+static bool InputSkip(ZlingInput* in, int n) {
+    while (n > 0) {
+        int len = std::min(n, InputPeek(in, 1));
+        if (len == 0) {
+            return false;
+        }
+        in->pos += len;
+        n -= len;
+    }
+    return true;
+}
+
+// ReadRound: read a whole round body (rolz blocks) into buf (ZlingRoundOutSize(window) bytes).
+//  return: number of bytes consumed from stdin, 0 on end of stream, -1 on error.
+static int ReadRound(ZlingInput* in, int window, unsigned char* buf, int* buflen, int* dlen) {
+    int blen = 0;
+    int size = 0;
+
+    *dlen = -1;
+
+    if (InputPeek(in, 1) < 1) {
+        return 0;
+    }
+    const unsigned char* header = in->buf + in->pos;
+    int flag = header[0];
+
+    if (flag == kFlagRoundSized) {
+        if (InputPeek(in, kRoundHeaderSize) < kRoundHeaderSize) {
+            return -1;
+        }
+        header = in->buf + in->pos;
+        uint32_t len = header[1] * 16777216u + header[2] * 65536u + header[3] * 256u + header[4];
+        uint32_t olen = header[5] * 16777216u + header[6] * 65536u + header[7] * 256u + header[8];
+        in->pos += kRoundHeaderSize;
+        if (len > uint32_t(ZlingRoundOutSize(window)) || olen > uint32_t(window) || !InputRead(in, buf, len)) {
+            return -1;
+        }
+        *buflen = len;
+        *dlen = olen;
+        return kRoundHeaderSize + len;
+    }
+
+    if (flag == kFlagRoundStart) {  // legacy round: collect rolz blocks one by one
+        in->pos += 1;
+        size += 1;
+        while (InputPeek(in, 1) >= 1 && in->buf[in->pos] == kFlagRoundBlock) {
+            unsigned char* header = buf + blen;
+
+            if (blen + kBlockHeaderSize > kBlockSizeOut || !InputRead(in, header, kBlockHeaderSize)) {
+                return -1;
+            }
+            uint32_t olen = header[2] * 16777216u + header[4] * 65536u + header[6] * 256u + header[8];
+            if (olen > uint32_t(kBlockSizeHuffman)
+                    || blen + kBlockHeaderSize + int(olen) > kBlockSizeOut
+                    || !InputRead(in, header + kBlockHeaderSize, olen)) {
+                return -1;
+            }
+            blen += kBlockHeaderSize + olen;
+        }
+        *buflen = blen;
+        return size + blen;
+    }
+
+    if (flag == kFlagIndex) {  // index frame: skip
+        if (InputPeek(in, kIndexHeaderSize) < kIndexHeaderSize) {
+            return -1;
+        }
+        header = in->buf + in->pos;
+        uint32_t nrounds = header[1] * 16777216u + header[2] * 65536u + header[3] * 256u + header[4];
+        if (nrounds > uint32_t(kIndexMaxRounds)) {
+            return -1;
+        }
+        int size = ZlingIndexSize(nrounds);
+        if (!InputSkip(in, size)) {
+            return -1;
+        }
+        *buflen = 0;
+        return size;
+    }
+
+    if (flag == kFlagWindow) {  // window frame (of a concatenated stream): skip if rounds fit
+        if (InputPeek(in, kWindowHeaderSize) < kWindowHeaderSize) {
+            return -1;
+        }
+        header = in->buf + in->pos;
+        uint32_t size = header[1] * 16777216u + header[2] * 65536u + header[3] * 256u + header[4];
+        if (size > uint32_t(window)) {
+            return -1;
+        }
+        in->pos += kWindowHeaderSize;
+        *buflen = 0;
+        return kWindowHeaderSize;
+    }
+    return 0;  // unknown flag: end of stream, left unread
+}
+
+static void ReadRoundJob(ZlingWorker* io) {
+    io->olen = ReadRound(io->input, io->window, io->ibuf, &io->ilen, &io->dlen);  // olen: bytes consumed
+    return;
+}
+
+// ZlingFrame: location of a round in the mapped source, and of its output in the mapped target.
+struct ZlingFrame {
+    uint64_t ipos;
+    uint64_t opos;
+    int      hlen;
+    int      size;
+    int      dlen;
+};
+
+// ScanFrames: locate all rounds of the mapped source.
+//  return: total decoded size, -1 if any round has unknown decoded size (legacy), -2 if corrupted.
+static int64_t ScanFrames(const ZlingMapping& src, int window, std::vector<ZlingFrame>* frames) {
+    const uint64_t max_frame_size = kRoundHeaderSize + ZlingRoundOutSize(window) + 1;
+    uint64_t ipos = 0;
+    uint64_t opos = 0;
+    bool sized = true;
+
+    while (ipos < src.size) {
+        int flag = src.data[ipos];
+        if (flag != kFlagRoundStart && flag != kFlagRoundSized && flag != kFlagIndex && flag != kFlagWindow) {
+            break;  // same as ReadRound(): stop at unknown flag
+        }
+        uint64_t len = (src.size - ipos < max_frame_size) ? src.size - ipos : max_frame_size;
+        ZlingFrame frame;
+        int need;
+
+        frame.size = ZlingParseRound(
+            src.data + ipos, len, ipos + len == src.size, &need, &frame.hlen, &frame.dlen, window);
+        if (frame.size <= 0) {
+            return -2;
+        }
+        frame.ipos = ipos;
+        frame.opos = opos;
+        if (frame.size > frame.hlen) {  // skip index/window frames
+            frames->push_back(frame);
+        }
+        sized &= (frame.dlen >= 0);
+        ipos += frame.size;
+        opos += (frame.dlen >= 0) ? frame.dlen : 0;
+    }
+    return sized ? opos : -1;
+}
+
+static int main_decode(const ZlingOptions& options) {
+    int nthreads = options.nthreads;
+    ZlingWorker* workers = new ZlingWorker[nthreads];
+    std::vector<ZlingFrame> frames;
+    ZlingMapping src;
+    ZlingMapping dst;
+    bool src_mapped = MapFile(stdin, false, 0, &src);  // decode straight from the mapped source
+    bool dst_mapped = false;                           // ... into the pre-sized mapped target
+    ZlingInput* input = NULL;
+    int window;
     uint64_t size_src = 0;
     uint64_t size_dst = 0;
-    int rlen = 0;
-    int olen = 0;
-    clock_t clock_start = clock();
-
-    InitMatchidxCode();
-
-    while (ungetc(fgetc(stdin), stdin) == 0) {  // flag: start rolz round
-        fgetc(stdin);
-        size_dst += 1;
-
-        int decpos = 0;
-        lzdecoder->Reset();
-
-        while (ungetc(fgetc(stdin), stdin) == 1) {  // flag: continue rolz round
-            fgetc(stdin);
-            size_dst += 1;
-
-            rlen  = fgetc(stdin) * 16777216;
-            olen  = fgetc(stdin) * 16777216;
-            rlen += fgetc(stdin) * 65536;
-            olen += fgetc(stdin) * 65536;
-            rlen += fgetc(stdin) * 256;
-            olen += fgetc(stdin) * 256;
-            rlen += fgetc(stdin);
-            olen += fgetc(stdin);
-            if (fread(obuf, 1, olen, stdin) != size_t(olen)) {
-                fprintf(stderr, "error: reading block with size '%d' error.", olen);
+    double time_start = GetTimeStart();
+
+    if (src_mapped) {
+        window = ZlingReadWindow(src.data, src.size);
+    } else {
+        input = new ZlingInput();
+        input->pos = 0;
+        input->len = 0;
+        window = ZlingReadWindow(input->buf, InputPeek(input, kWindowHeaderSize));
+    }
+    if (window == -1) {
+        fprintf(stderr, "error: reading round error.\n");
+        return -1;
+    }
+
+    if (src_mapped) {
+        int64_t size = ScanFrames(src, window, &frames);
+        if (size == -2) {
+            fprintf(stderr, "error: reading round error.\n");
+            return -1;
+        }
+        size_dst += frames.empty() ? 0 : frames[0].ipos;  // leading window frame
+        dst_mapped = (size > 0 && !options.test && MapFile(stdout, true, size, &dst));
+    }
+
+    // streaming: with a single worker, blocks are written while their round is still decoding,
+    //  so a pipe reader waits for one block instead of one round.
+    bool streaming = (nthreads == 1 && !dst_mapped && !options.test);
+
+    ZlingWorker reader;
+    ZlingWorker writer;
+
+    if (StartIOWorker(&reader, src_mapped ? 0 : ZlingRoundOutSize(window) + 16, 0) == -1
+            || StartIOWorker(&writer, 0, (dst_mapped || streaming) ? 0 : window) == -1) {
+        fprintf(stderr, "error: cannot create I/O thread.\n");
+        return -1;
+    }
+    if (!src_mapped) {
+        reader.input = input;
+        reader.window = window;
+        SubmitWorker(&reader, ReadRoundJob);
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        workers[i].decoder = new ZlingRoundDecoder();
+        workers[i].decoder->SetPipeline(options.pipeline);
+        workers[i].decoder->SetSink(streaming ? WriteSink : NULL, NULL);
+        if (!options.dict.empty()) {
+            workers[i].decoder->SetDictionary(&options.dict[0], options.dict.size());
+        }
+        workers[i].ibuf_owned = new unsigned char[ZlingRoundOutSize(window) + 16];  // avoid overflow on decoding
+        workers[i].obuf_owned = dst_mapped ? NULL : new unsigned char[window];
+        workers[i].ibuf = workers[i].ibuf_owned;
+        workers[i].obuf = workers[i].obuf_owned;
+        workers[i].ocap = window;
+        workers[i].ilen = 0;
+        workers[i].olen = 0;
+        workers[i].dlen = -1;
+        if (StartWorker(&workers[i], nthreads > 1) == -1) {
+            fprintf(stderr, "error: cannot create worker thread.\n");
+            return -1;
+        }
+    }
+
+    // round r is decoded by workers[r % nthreads], same as main_encode().
+    for (int round = 0, eof = 0, pending = 0; !eof || pending > 0; round++) {
+        ZlingWorker* worker = &workers[round % nthreads];
+        int size = 0;
+
+        if (worker->ilen > 0) {
+            WaitWorker(worker);
+            if (worker->olen == -1 || (worker->dlen >= 0 && worker->olen != worker->dlen)) {
+                fprintf(stderr, "error: corrupted round.\n");
                 return -1;
             }
-            size_dst += 8;
-            size_dst += olen;
-
-            // HUFFMAN DECODE
-            // ============================================================
-            ZlingCodebuf codebuf;
-            int opos = 0;
-            uint32_t length_table1[kHuffmanCodes1] = {0};
-            uint32_t length_table2[kHuffmanCodes2] = {0};
-            uint16_t decode_table1[1 << kHuffmanMaxLen1];
-            uint16_t decode_table2[1 << kHuffmanMaxLen2];
-            uint16_t decode_table1_fast[1 << kHuffmanMaxLen1Fast];
-            uint16_t encode_table1[kHuffmanCodes1];
-            uint16_t encode_table2[kHuffmanCodes2];
-
-            // read length table
-            for (int i = 0; i < kHuffmanCodes1; i += 2) {
-                length_table1[i] =     obuf[opos] / 16;
-                length_table1[i + 1] = obuf[opos] % 16;
-                opos++;
+            if (!dst_mapped && !options.test && !streaming) {
+                WaitWorker(&writer);
+                SwapOutput(worker, &writer);
+                writer.olen = worker->olen;
+                SubmitWorker(&writer, WriteJob);
             }
-            for (int i = 0; i < kHuffmanCodes2; i += 2) {
-                length_table2[i] =     obuf[opos] / 16;
-                length_table2[i + 1] = obuf[opos] % 16;
-                opos++;
+            size_src += worker->olen;
+            worker->ilen = 0;
+            pending--;
+
+            fprintf(stderr, "%6.2f MB <= %6.2f MB %.2f%%, %.3f sec, speed=%.3f MB/sec\n",
+                    size_src / 1e6,
+                    size_dst / 1e6,
+                    1e2 * size_dst / size_src, GetTimeCost(time_start),
+                    size_src / GetTimeCost(time_start) / 1e6);
+            fflush(stderr);
+        }
+
+        if (!eof && src_mapped && size_t(round) < frames.size()) {
+            const ZlingFrame& frame = frames[round];
+
+            worker->ibuf = src.data + frame.ipos + frame.hlen;
+            worker->ilen = frame.size - frame.hlen;
+            worker->dlen = frame.dlen;
+            if (frame.ipos + frame.size + 16 > src.size) {  // decoder reads up to 16 bytes beyond the round
+                memcpy(worker->ibuf_owned, worker->ibuf, worker->ilen);
+                worker->ibuf = worker->ibuf_owned;
             }
-            if (opos % 4 != 0) opos++;  // keep aligned
-            if (opos % 4 != 0) opos++;  // keep aligned
-            if (opos % 4 != 0) opos++;  // keep aligned
-            if (opos % 4 != 0) opos++;  // keep aligned
-
-            ZlingMakeEncodeTable(length_table1, encode_table1, kHuffmanCodes1, kHuffmanMaxLen1);
-            ZlingMakeEncodeTable(length_table2, encode_table2, kHuffmanCodes2, kHuffmanMaxLen2);
-
-            // decode_table1: 2-level decode table
-            ZlingMakeDecodeTable(length_table1,
-                                 encode_table1,
-                                 decode_table1,
-                                 kHuffmanCodes1,
-                                 kHuffmanMaxLen1);
-            ZlingMakeDecodeTable(length_table1,
-                                 encode_table1,
-                                 decode_table1_fast,
-                                 kHuffmanCodes1,
-                                 kHuffmanMaxLen1Fast);
-
-            // decode_table2: 1-level decode table
-            ZlingMakeDecodeTable(length_table2,
-                                 encode_table2,
-                                 decode_table2,
-                                 kHuffmanCodes2,
-                                 kHuffmanMaxLen2);
-
-            // decode
-            for (int i = 0; i < rlen; i++) {
-                while (/* opos < olen && */ codebuf.GetLength() < 32) {
-#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-                    codebuf.Input(*reinterpret_cast<uint32_t*>(obuf + opos), 32);
-                    opos += 4;
-#else
-                    codebuf.Input(obuf[opos++], 8);
-                    codebuf.Input(obuf[opos++], 8);
-                    codebuf.Input(obuf[opos++], 8);
-                    codebuf.Input(obuf[opos++], 8);
-#endif
-                }
-
-                tbuf[i] = decode_table1_fast[codebuf.Peek(kHuffmanMaxLen1Fast)];
-                if (tbuf[i] == uint16_t(-1)) {
-                    tbuf[i] = decode_table1[codebuf.Peek(kHuffmanMaxLen1)];
-                }
-                codebuf.Output(length_table1[tbuf[i]]);
-
-                if (tbuf[i] >= 256) {
-                    uint32_t code = decode_table2[codebuf.Peek(kHuffmanMaxLen2)];
-                    uint32_t bitlen = IdxBitlenFromCode(code);
-                    codebuf.Output(length_table2[code]);
-                    tbuf[++i] = IdxFromCodeBits(code, codebuf.Output(bitlen));
-                }
+            if (dst_mapped) {
+                worker->obuf = dst.data + frame.opos;
+                worker->ocap = frame.dlen;
+            }
+            size = frame.size + (round + 1 < int(frames.size()) ? frames[round + 1].ipos : src.size)
+                - frame.ipos - frame.size;  // count skipped index frames
+        } else if (!eof && !src_mapped) {
+            WaitWorker(&reader);
+            SwapInput(worker, &reader);
+            worker->ilen = reader.ilen;
+            worker->dlen = reader.dlen;
+            size = reader.olen;
+            if (size > 0) {
+                SubmitWorker(&reader, ReadRoundJob);  // prefetch next round
             }
+        }
 
-            // ROLZ decode
-            // ============================================================
-            rlen = lzdecoder->Decode(tbuf, ibuf, rlen, &decpos);
+        if (!eof && size > 0) {
+            size_dst += size;
+            if (worker->ilen > 0) {
+                SubmitWorker(worker, DecodeJob);
+                pending++;
+            }
+        } else {
+            if (size == -1) {
+                fprintf(stderr, "error: reading round error.\n");
+                return -1;
+            }
+            worker->ilen = 0;
+            eof = 1;
         }
+    }
 
-        // output
-        fwrite(ibuf, 1, decpos, stdout);
-        size_src += decpos;
-        fprintf(stderr, "%6.2f MB <= %6.2f MB %.2f%%, %.3f sec, speed=%.3f MB/sec\n",
-                size_src / 1e6,
-                size_dst / 1e6,
-                1e2 * size_dst / size_src, GetTimeCost(clock_start),
-                size_src / GetTimeCost(clock_start) / 1e6);
-        fflush(stderr);
+    for (int i = 0; i < nthreads; i++) {
+        StopWorker(&workers[i]);
+        delete workers[i].decoder;
+        delete [] workers[i].ibuf_owned;
+        delete [] workers[i].obuf_owned;
+    }
+    delete [] workers;
+    StopIOWorker(&reader);
+    delete reader.input;
+    StopIOWorker(&writer);
+    if (src_mapped) {
+        UnmapFile(&src);
+    }
+    if (dst_mapped) {
+        UnmapFile(&dst);
     }
-    delete lzdecoder;
 
     if (ferror(stdin) || ferror(stdout)) {
         fprintf(stderr, "error: I/O error.\n");
@@ -397,11 +911,148 @@ static int main_decode() {
     }
 
     fprintf(stderr,
-            "\ndecode: %llu <= %llu, time=%.3f sec, speed=%.3f MB/sec\n",
-            size_src,
-            size_dst,
-            GetTimeCost(clock_start),
-            size_src / GetTimeCost(clock_start) / 1e6);
+            "\n%s: %llu <= %llu, time=%.3f sec, speed=%.3f MB/sec\n",
+            options.test ? "test ok" : "decode",
+            static_cast<unsigned long long>(size_src),
+            static_cast<unsigned long long>(size_dst),
+            GetTimeCost(time_start),
+            size_src / GetTimeCost(time_start) / 1e6);
+    return 0;
+}
+
+static int main_decode_range(const ZlingOptions& options) {
+    ZlingRoundDecoder* decoder = new ZlingRoundDecoder();
+    decoder->SetPipeline(options.pipeline);
+    std::vector<ZlingIndexEntry> index;
+
+    if (!options.dict.empty()) {
+        decoder->SetDictionary(&options.dict[0], options.dict.size());
+    }
+    unsigned char header[kWindowHeaderSize] = {0};
+    unsigned char trailer[kIndexTrailerSize];
+    uint64_t offset = options.range_offset;
+    uint64_t length = options.range_length;
+    uint64_t size_src = 0;
+    uint64_t size_dst = 0;
+    double time_start = GetTimeStart();
+
+    // load window from the start and index from the end of stream
+    if (fseeko(stdin, -kIndexTrailerSize, SEEK_END) != 0 || fread(trailer, 1, sizeof(trailer), stdin) != sizeof(trailer)) {
+        fprintf(stderr, "error: source is not seekable.\n");
+        return -1;
+    }
+    int window = (fseeko(stdin, 0, SEEK_SET) == 0) ? ZlingReadWindow(header, fread(header, 1, sizeof(header), stdin)) : -1;
+    if (window == -1) {
+        fprintf(stderr, "error: reading round error.\n");
+        return -1;
+    }
+    std::vector<unsigned char> ibuf(kRoundHeaderSize + ZlingRoundOutSize(window) + 16);
+    std::vector<unsigned char> obuf(window);
+
+    int index_size = ZlingReadIndexSize(trailer);
+    std::vector<unsigned char> index_buf(index_size > 0 ? index_size : 1);
+    if (index_size == -1
+            || fseeko(stdin, -index_size, SEEK_END) != 0
+            || fread(&index_buf[0], 1, index_size, stdin) != size_t(index_size)
+            || ZlingReadIndex(&index_buf[0], index_size, &index, window) == -1) {
+        fprintf(stderr, "error: source has no valid index, encode with 'zling e -s'.\n");
+        return -1;
+    }
+
+    // decode overlapping rounds
+    uint64_t round_ipos = (header[0] == kFlagWindow) ? kWindowHeaderSize : 0;
+    uint64_t round_opos = 0;
+
+    for (size_t i = 0; i < index.size() && size_src < length; i++) {
+        uint64_t round_end = round_opos + index[i].dlen;
+
+        if (round_end > offset) {
+            int size = index[i].size;
+            int need;
+            int hlen;
+            int dlen;
+
+            if (fseeko(stdin, round_ipos, SEEK_SET) != 0
+                    || fread(&ibuf[0], 1, size, stdin) != size_t(size)
+                    || ZlingParseRound(&ibuf[0], size, true, &need, &hlen, &dlen, window) != size
+                    || dlen != int(index[i].dlen)) {
+                fprintf(stderr, "error: reading round error.\n");
+                return -1;
+            }
+            size_t from = offset > round_opos ? offset - round_opos : 0;
+            size_t stop = dlen - from < length - size_src ? dlen : from + (length - size_src);
+
+            if (decoder->Decode(&ibuf[hlen], size - hlen, &obuf[0], window, stop) < int(stop)) {
+                fprintf(stderr, "error: corrupted round.\n");
+                return -1;
+            }
+            fwrite(&obuf[from], 1, stop - from, stdout);
+            size_src += stop - from;
+            size_dst += size;
+        }
+        round_ipos += index[i].size;
+        round_opos = round_end;
+    }
+    delete decoder;
+
+    if (ferror(stdin) || ferror(stdout)) {
+        fprintf(stderr, "error: I/O error.\n");
+        return -1;
+    }
+
+    fprintf(stderr,
+            "\ndecode range: %llu <= %llu, time=%.3f sec, speed=%.3f MB/sec\n",
+            static_cast<unsigned long long>(size_src),
+            static_cast<unsigned long long>(size_dst),
+            GetTimeCost(time_start),
+            size_src / GetTimeCost(time_start) / 1e6);
+    return 0;
+}
+
+// main_train: zling train [-n size] dict samples...
+static int main_train(int argc, char** argv) {
+    std::vector<unsigned char> samples;
+    std::vector<unsigned char> sample;
+    std::vector<int> sizes;
+    std::vector<unsigned char> dict;
+    const char* dictfile = NULL;
+    int dictsize = kDictDefaultSize;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            dictsize = atoi(argv[++i]);
+            if (dictsize < 1 || dictsize > kDictMaxSize) {
+                fprintf(stderr, "error: dictionary size should be 1..%d.\n", kDictMaxSize);
+                return -1;
+            }
+            continue;
+        }
+        if (dictfile == NULL) {
+            dictfile = argv[i];
+            continue;
+        }
+        if (LoadFile(argv[i], kBlockSizeIn, &sample) == -1) {
+            return -1;
+        }
+        samples.insert(samples.end(), sample.begin(), sample.end());
+        sizes.push_back(sample.size());
+    }
+    if (dictfile == NULL || sizes.empty()) {
+        fprintf(stderr, "usage:\n");
+        fprintf(stderr, "   zling train [-n size] dict samples...\n");
+        fprintf(stderr, "    * size: max dictionary size, default to %d\n", kDictDefaultSize);
+        return -1;
+    }
+
+    dict.resize(dictsize);
+    dict.resize(ZlingTrainDictionary(&samples[0], &sizes[0], sizes.size(), &dict[0], dictsize));
+
+    FILE* fp = fopen(dictfile, "wb");
+    if (fp == NULL || fwrite(&dict[0], 1, dict.size(), fp) != dict.size() || fclose(fp) != 0) {
+        fprintf(stderr, "error: cannot write dictionary '%s'.\n", dictfile);
+        return -1;
+    }
+    fprintf(stderr, "train: %d samples => %d bytes dictionary\n", int(sizes.size()), int(dict.size()));
     return 0;
 }
 
@@ -419,33 +1070,124 @@ int main(int argc, char** argv) {
     fprintf(stderr, "   by Zhang Li <zhangli10 at baidu.com>\n");
     fprintf(stderr, "\n");
 
+    // zling <e/d> [options] __argv2__ __argv3__
+    const char* mode = (argc >= 2) ? argv[1] : "";
+
+    if (strcmp(mode, "train") == 0) {
+        return main_train(argc, argv);
+    }
+    const char* files[2] = {NULL, NULL};
+    int nfiles = 0;
+    bool badargs = false;
+    ZlingOptions options;
+
+    options.level = kDefaultLevel;
+    options.nthreads = 1;
+    options.window = kBlockSizeIn;
+    options.seekable = false;
+    options.checksum = false;
+    options.pipeline = false;
+    options.test = (strcmp(mode, "t") == 0);
+    options.range = false;
+    options.range_offset = 0;
+    options.range_length = 0;
+    options.stats = NULL;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) {
+            options.nthreads = atoi(argv[++i]);
+            badargs |= (options.nthreads < 1 || options.nthreads > kMaxThreads);
+            continue;
+        }
+        if (strcmp(argv[i], "-W") == 0 && i + 1 < argc) {
+            int window = atoi(argv[++i]);
+            badargs |= (window < kBlockSizeIn >> 20 || window > kWindowSizeMax >> 20);
+            options.window = window << 20;
+            continue;
+        }
+        if (argv[i][0] == '-' && argv[i][1] >= '0' + kMinLevel && argv[i][1] <= '0' + kMaxLevel && argv[i][2] == 0) {
+            options.level = argv[i][1] - '0';
+            continue;
+        }
+        if (strcmp(argv[i], "-s") == 0) {
+            options.seekable = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-c") == 0) {
+            options.checksum = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-P") == 0) {
+            options.pipeline = true;
+            continue;
+        }
+        if (strcmp(argv[i], "-D") == 0 && i + 1 < argc) {
+            if (LoadFile(argv[++i], kDictMaxSize, &options.dict) == -1) {
+                return -1;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            options.stats = argv[++i];
+#if !ZLING_STATS
+            fprintf(stderr, "error: --stats needs a build with statistics (make STATS=1).\n");
+            return -1;
+#endif
+            continue;
+        }
+        if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+            options.range = true;
+            badargs |= (sscanf(argv[++i], "%llu:%llu",
+                               reinterpret_cast<unsigned long long*>(&options.range_offset),
+                               reinterpret_cast<unsigned long long*>(&options.range_length)) != 2);
+            continue;
+        }
+        if (argv[i][0] == '-' || nfiles == 2) {
+            badargs = true;
+            continue;
+        }
+        files[nfiles++] = argv[i];
+    }
+
     // zling <e/d> __argv2__ __argv3__
-    if (argc == 4) {
-        if (freopen(argv[3], "wb", stdout) == NULL) {
-            fprintf(stderr, "error: cannot open file '%s' for write.\n", argv[3]);
+    badargs |= (options.test && (nfiles == 2 || options.range));
+    if (!badargs && nfiles == 2) {
+        if (freopen(files[1], "w+b", stdout) == NULL) {  // readable too, so it can be mapped
+            fprintf(stderr, "error: cannot open file '%s' for write.\n", files[1]);
             return -1;
         }
-        argc = 3;
     }
 
     // zling <e/d> __argv2__ (stdout)
-    if (argc == 3) {
-        if (freopen(argv[2], "rb", stdin) == NULL) {
-            fprintf(stderr, "error: cannot open file '%s' for read.\n", argv[2]);
+    if (!badargs && nfiles >= 1) {
+        if (freopen(files[0], "rb", stdin) == NULL) {
+            fprintf(stderr, "error: cannot open file '%s' for read.\n", files[0]);
             return -1;
         }
-        argc = 2;
     }
 
     // zling <e/d> (stdin) (stdout)
-    if (argc == 2 && strcmp(argv[1], "e") == 0) return main_encode();
-    if (argc == 2 && strcmp(argv[1], "d") == 0) return main_decode();
+    if (!badargs && strcmp(mode, "e") == 0) return main_encode(options);
+    if (!badargs && strcmp(mode, "d") == 0 && options.range) return main_decode_range(options);
+    if (!badargs && strcmp(mode, "d") == 0) return main_decode(options);
+    if (!badargs && strcmp(mode, "t") == 0) return main_decode(options);
 
     // help message
     fprintf(stderr, "usage:\n");
-    fprintf(stderr, "   zling e source target\n");
-    fprintf(stderr, "   zling d source target\n");
+    fprintf(stderr, "   zling e [-1..-9] [-T threads] [-W MB] [-P] [-s] [-c] [-D dict] [--stats file] source target\n");
+    fprintf(stderr, "   zling d [-T threads] [-P] [-R offset:length] [-D dict] source target\n");
+    fprintf(stderr, "   zling t [-T threads] [-P] [-D dict] source\n");
+    fprintf(stderr, "   zling train [-n size] dict samples...\n");
     fprintf(stderr, "    * source: default to stdin\n");
     fprintf(stderr, "    * target: default to stdout\n");
+    fprintf(stderr, "    * -1..-9: compression level, fastest to best, default to -%d\n", kDefaultLevel);
+    fprintf(stderr, "    * threads: encode/decode rounds in parallel, default to 1\n");
+    fprintf(stderr, "    * -W: large window, rounds of 16..256 MB (default 16), more memory per thread\n");
+    fprintf(stderr, "    * -P: pipeline, huffman coding/decoding overlaps rolz in a second thread per round\n");
+    fprintf(stderr, "    * -s: seekable, append round index for range decoding\n");
+    fprintf(stderr, "    * -c: store crc32c of each round, verified by 'zling d' and 'zling t'\n");
+    fprintf(stderr, "    * -R: decode only bytes [offset, offset + length) of a seekable source\n");
+    fprintf(stderr, "    * -D: prime rounds with a dictionary built by 'zling train', needed to decode\n");
+    fprintf(stderr, "    * --stats: write per-block encoder statistics as JSON (STATS=1 builds)\n");
     return -1;
 }
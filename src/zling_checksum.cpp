@@ -0,0 +1,141 @@
+/**
+ * zling:
+ *  light-weight lossless data compression utility.
+ *
+ * Copyright (C) 2012-2013 by Zhang Li <zhangli10 at baidu.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * @author zhangli10<zhangli10@baidu.com>
+ * @brief  crc32c checksums of decoded rounds.
+ */
+#include <cstring>
+
+#include "src/zling_checksum.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)  // SSE4.2 picked at runtime by cpu feature
+#define ZLING_HAS_SSE42_CRC32 1
+#include <nmmintrin.h>
+#endif
+
+namespace baidu {
+namespace zling {
+namespace checksum {
+
+static const uint32_t kCrc32cPoly = 0x82f63b78;  // reversed castagnoli polynomial
+
+// crc_table[k][b]: crc of byte b followed by k zero bytes, for slicing-by-8.
+static uint32_t crc_table[8][256];
+
+static inline void InitCrcTable() {
+    for (int b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (kCrc32cPoly & -(crc & 1));
+        }
+        crc_table[0][b] = crc;
+    }
+    for (int b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) {
+            crc_table[k][b] = (crc_table[k - 1][b] >> 8) ^ crc_table[0][crc_table[k - 1][b] & 0xff];
+        }
+    }
+    return;
+}
+
+// tables are built once at load time, before any encoder/decoder thread is started.
+static struct ZlingCrcTableInitializer {
+    ZlingCrcTableInitializer() {
+        InitCrcTable();
+    }
+} crc_table_initializer;
+
+static uint32_t Crc32cTable(uint32_t crc, const unsigned char* buf, int len) {
+    while (len > 0 && reinterpret_cast<uintptr_t>(buf) % 8 != 0) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *buf++) & 0xff];
+        len--;
+    }
+    while (len >= 8) {
+        uint32_t lo;
+        uint32_t hi;
+        memcpy(&lo, buf, 4);
+        memcpy(&hi, buf + 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        lo = __builtin_bswap32(lo);
+        hi = __builtin_bswap32(hi);
+#endif
+        lo ^= crc;
+        crc = crc_table[7][lo & 0xff] ^ crc_table[6][lo >> 8 & 0xff] ^
+              crc_table[5][lo >> 16 & 0xff] ^ crc_table[4][lo >> 24] ^
+              crc_table[3][hi & 0xff] ^ crc_table[2][hi >> 8 & 0xff] ^
+              crc_table[1][hi >> 16 & 0xff] ^ crc_table[0][hi >> 24];
+        buf += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *buf++) & 0xff];
+    }
+    return crc;
+}
+
+#if ZLING_HAS_SSE42_CRC32
+__attribute__((target("sse4.2")))
+static uint32_t Crc32cSSE42(uint32_t crc, const unsigned char* buf, int len) {
+    uint64_t crc64 = crc;
+
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, buf, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        buf += 8;
+        len -= 8;
+    }
+    crc = crc64;
+    while (len-- > 0) {
+        crc = _mm_crc32_u8(crc, *buf++);
+    }
+    return crc;
+}
+
+static bool DetectSSE42() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+static const bool kHasSSE42 = DetectSSE42();
+#endif
+
+uint32_t ZlingCrc32c(uint32_t crc, const unsigned char* buf, int len) {
+#if ZLING_HAS_SSE42_CRC32
+    if (kHasSSE42) {
+        return ~Crc32cSSE42(~crc, buf, len);
+    }
+#endif
+    return ~Crc32cTable(~crc, buf, len);
+}
+
+}  // namespace checksum
+}  // namespace zling
+}  // namespace baidu
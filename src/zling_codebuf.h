@@ -35,6 +35,8 @@
 #ifndef SRC_ZLING_CODEBUF_H
 #define SRC_ZLING_CODEBUF_H
 
+#include <cstring>
+
 #if HAS_CXX11_SUPPORT
 #include <cstdint>
 #else
@@ -70,6 +72,23 @@ public:
         return m_buf & ~(-1ull << len);
     }
 
+    /* Refill: top up the buffer to at least 56 bits with one unaligned 64-bit load.
+     *  arg buf: input, 8 bytes must be readable.
+     *  return: number of bytes consumed from buf.
+     */
+    inline int Refill(const unsigned char* buf) {
+        uint64_t word;
+        memcpy(&word, buf, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        // bits loaded beyond the consumed bytes are loaded again at the same place next time
+        int consumed = (63 - m_len) >> 3;
+        m_buf |= word << m_len;
+        m_len |= 56;
+        return consumed;
+    }
+
     inline int GetLength() const {
         return m_len;
     }
@@ -0,0 +1,1469 @@
+/**
+ * zling:
+ *  light-weight lossless data compression utility.
+ *
+ * Copyright (C) 2012-2013 by Zhang Li <zhangli10 at baidu.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * @author zhangli10<zhangli10@baidu.com>
+ * @brief  encode/decode rolz rounds (rolz + huffman stages).
+ */
+#include <algorithm>
+#include <cmath>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "src/zling_codec.h"
+#include "src/zling_checksum.h"
+#include "src/zling_codebuf.h"
+#include "src/zling_dict.h"
+#include "src/zling_huffman.h"
+
+namespace baidu {
+namespace zling {
+namespace codec {
+
+using checksum::ZlingCrc32c;
+using codebuf::ZlingCodebuf;
+using huffman::ZlingMakeLengthTable;
+using huffman::ZlingMakeEncodeTable;
+using huffman::ZlingMakePackedDecodeTable;
+using huffman::kPackedLenShift;
+using huffman::kPackedInvalid;
+using dict::ZlingDictionaryId;
+using dict::kDictMaxSize;
+using lz::ZlingRolzEncoder;
+using lz::ZlingRolzDecoder;
+
+using lz::kMatchMaxLen;
+using lz::kMatchMinLen;
+using lz::kBucketItemSize;
+
+static const unsigned char matchidx_bitlen[] = {
+    /* 0 */ 0, 0, 0, 0,
+    /* 4 */ 1, 1,
+    /* 6 */ 2, 2,
+    /* 8 */ 3, 3,
+    /* 10*/ 4, 4,
+    /* 12*/ 5, 5,
+    /* 14*/ 6, 6,
+    /* 16*/ 7, 7,
+    /* 18*/ 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+    /* 32*/
+};
+static const int kMatchidxCodeSymbols = sizeof(matchidx_bitlen) / sizeof(matchidx_bitlen[0]);
+static const int kMatchidxMaxBitlen = 8;
+
+static unsigned char matchidx_code[kBucketItemSize];
+static unsigned char matchidx_bits[kBucketItemSize];
+static uint16_t      matchidx_base[kMatchidxCodeSymbols];
+
+static inline void InitMatchidxCode() {
+    int code = 0;
+    int bits = 0;
+
+    for (int i = 0; i < kBucketItemSize; i++) {
+        matchidx_code[i] = code;
+        matchidx_bits[i] = bits;
+
+        if (i + 1 < kBucketItemSize && (++bits) >> matchidx_bitlen[code] != 0) {
+            bits = 0;
+            matchidx_base[++code] = i + 1;
+        }
+    }
+    return;
+}
+
+static inline uint32_t IdxToCode(uint32_t idx) {
+    return matchidx_code[idx];
+}
+static inline uint32_t IdxToBits(uint32_t idx) {
+    return matchidx_bits[idx];
+}
+static inline uint32_t IdxToBitlen(uint32_t idx) {
+    return matchidx_bitlen[matchidx_code[idx]];
+}
+
+static inline uint32_t IdxBitlenFromCode(uint32_t code) {
+    return matchidx_bitlen[code];
+}
+static inline uint32_t IdxFromCodeBits(uint32_t code, uint32_t bits) {
+    return matchidx_base[code] | bits;
+}
+
+static const int kHuffmanCodes1      = 256 + (kMatchMaxLen - kMatchMinLen + 1);  // must be even
+static const int kHuffmanCodes2      = kMatchidxCodeSymbols;                     // must be even
+static const int kHuffmanMaxLen1     = 15;
+static const int kHuffmanMaxLen2     = 8;
+static const int kHuffmanMaxLen1Fast = 10;
+static const int kHuffmanStreams     = 4;
+static const int kHuffmanTableSize   = ((kHuffmanCodes1 + kHuffmanCodes2) / 2 + 3) / 4 * 4;  // aligned
+
+// encode tables of a huffman block.
+struct ZlingEncodeTables {
+    uint32_t length_table1[kHuffmanCodes1];
+    uint32_t length_table2[kHuffmanCodes2];
+    uint16_t encode_table1[kHuffmanCodes1];
+    uint16_t encode_table2[kHuffmanCodes2];
+};
+
+// decode tables of a huffman block, entries packed by ZlingMakePackedDecodeTable().
+struct ZlingDecodeTables {
+    uint16_t table1[1 << kHuffmanMaxLen1];
+    uint16_t table1_fast[1 << kHuffmanMaxLen1Fast];
+    uint32_t table2[1 << kHuffmanMaxLen2];
+};
+
+static inline void MakeEncodeTables(const uint32_t* freq_table1,
+                                    const uint32_t* freq_table2,
+                                    ZlingEncodeTables* tables) {
+    ZlingMakeLengthTable(freq_table1, tables->length_table1, 0, kHuffmanCodes1, kHuffmanMaxLen1);
+    ZlingMakeLengthTable(freq_table2, tables->length_table2, 0, kHuffmanCodes2, kHuffmanMaxLen2);
+
+    ZlingMakeEncodeTable(tables->length_table1, tables->encode_table1, kHuffmanCodes1, kHuffmanMaxLen1);
+    ZlingMakeEncodeTable(tables->length_table2, tables->encode_table2, kHuffmanCodes2, kHuffmanMaxLen2);
+    return;
+}
+
+// GetCodeBits: encoded size of symbols with given tables (without extra bits), -1 if a symbol has no code.
+static inline double GetCodeBits(const uint32_t* freq_table1,
+                                 const uint32_t* freq_table2,
+                                 const ZlingEncodeTables& tables) {
+    double bits = 0;
+
+    for (int c = 0; c < kHuffmanCodes1; c++) {
+        if (freq_table1[c] > 0 && tables.length_table1[c] == 0) {
+            return -1;
+        }
+        bits += freq_table1[c] * tables.length_table1[c];
+    }
+    for (int c = 0; c < kHuffmanCodes2; c++) {
+        if (freq_table2[c] > 0 && tables.length_table2[c] == 0) {
+            return -1;
+        }
+        bits += freq_table2[c] * tables.length_table2[c];
+    }
+    return bits;
+}
+
+static inline void MakeDecodeTables(const uint32_t* length_table1,
+                                    const uint32_t* length_table2,
+                                    ZlingDecodeTables* tables) {
+    uint16_t encode_table1[kHuffmanCodes1];
+    uint16_t encode_table2[kHuffmanCodes2];
+
+    ZlingMakeEncodeTable(length_table1, encode_table1, kHuffmanCodes1, kHuffmanMaxLen1);
+    ZlingMakeEncodeTable(length_table2, encode_table2, kHuffmanCodes2, kHuffmanMaxLen2);
+
+    // table1: 2-level decode table, entries packed with code length
+    ZlingMakePackedDecodeTable(length_table1,
+                               encode_table1,
+                               tables->table1,
+                               kHuffmanCodes1,
+                               kHuffmanMaxLen1);
+    ZlingMakePackedDecodeTable(length_table1,
+                               encode_table1,
+                               tables->table1_fast,
+                               kHuffmanCodes1,
+                               kHuffmanMaxLen1Fast);
+
+    // table2: 1-level decode table, entries packed as (bitlen << 24 | codelen << 16 | idx base),
+    //  so the match index code and its extra bits are taken in one step.
+    memset(tables->table2, -1, sizeof(tables->table2));
+    for (int c = 0; c < kHuffmanCodes2; c++) {
+        if (length_table2[c] > 0) {
+            uint32_t entry = IdxBitlenFromCode(c) << 24 | length_table2[c] << 16 | IdxFromCodeBits(c, 0);
+            for (int i = encode_table2[c]; i < (1 << kHuffmanMaxLen2); i += (1 << length_table2[c])) {
+                tables->table2[i] = entry;
+            }
+        }
+    }
+    return;
+}
+
+// static tables: codes for small blocks, where a length table would cost more than it saves.
+//  built from a fixed model of text-like data (every symbol gets a code), must never change
+//  since encoded streams depend on them.
+static const int kStaticMaxSymbols = 32768;  // larger blocks always use their own tables
+
+static ZlingEncodeTables static_encode_tables;
+static ZlingDecodeTables static_decode_tables;
+
+static inline void InitStaticTables() {
+    uint32_t freq_table1[kHuffmanCodes1];
+    uint32_t freq_table2[kHuffmanCodes2];
+
+    for (int c = 0; c < 256; c++) {
+        freq_table1[c] = 1;
+        if (c >= 32 && c < 127) freq_table1[c] = 6;  // printable
+        if (c >= '0' && c <= '9') freq_table1[c] = 12;
+        if (c >= 'a' && c <= 'z') freq_table1[c] = 16;
+        if (strchr("etaoinsr", c) != NULL && c != 0) freq_table1[c] = 24;
+        if (c == ' ') freq_table1[c] = 64;
+        if (c == '\n' || c == '"') freq_table1[c] = 12;
+        if (c == '\t' || c == '\r' || c == 0) freq_table1[c] = 4;
+    }
+    for (int c = 256; c < kHuffmanCodes1; c++) {  // match lengths: shorter matches are more frequent
+        freq_table1[c] = std::max(1, 96 / (c - 256 + 1));
+    }
+    for (int c = 0; c < kHuffmanCodes2; c++) {  // match index codes: spread over the first few codes
+        freq_table2[c] = (c <= 12) ? 16 : std::max(1, 16 >> (c - 12));
+    }
+    MakeEncodeTables(freq_table1, freq_table2, &static_encode_tables);
+    MakeDecodeTables(static_encode_tables.length_table1, static_encode_tables.length_table2, &static_decode_tables);
+    return;
+}
+
+// stored blocks: a block whose bytes look random (order-0 entropy close to 8 bits) is copied
+//  verbatim, matching and huffman coding would only cost time and table bytes.
+static const double kStoredMinEntropy = 7.9;  // bits per byte
+static const int    kStoredMinSize    = 16384;
+static const int    kStoredProbeSpan  = 256;   // probe the first kStoredProbeLen bytes of each span,
+static const int    kStoredProbeLen   = 64;    //  contiguous so that all lanes of fixed-size records count
+
+// IsIncompressible: cheap probe on an incoming block, before rolz encoding.
+static inline bool IsIncompressible(const unsigned char* buf, int len) {
+    uint32_t freq[256] = {0};
+    double total = 0;
+    double bits = 0;
+
+    if (len < kStoredMinSize) {  // too few samples, entropy looks lower than it is
+        return false;
+    }
+    for (int i = 0; i + kStoredProbeLen <= len; i += kStoredProbeSpan) {
+        for (int j = 0; j < kStoredProbeLen; j++) {
+            freq[buf[i + j]] += 1;
+        }
+        total += kStoredProbeLen;
+    }
+    for (int c = 0; c < 256; c++) {
+        bits += (freq[c] > 0) ? freq[c] * log2(total / freq[c]) : 0;
+    }
+    return bits >= total * kStoredMinEntropy;
+}
+
+// sub-blocks: rolz output of a block is cut into huffman blocks where symbol statistics change
+//  (e.g. text followed by binary in an archive), so each part gets its own tables.
+static const int kSplitSegmentSize = 16384;  // symbols, granularity of boundaries
+static const int kSplitMaxBlocks   = kBlockSizeRolz / kSplitSegmentSize + 1;
+
+// GetEntropyBits: estimated huffman-coded size of symbols (without extra bits).
+static inline double GetEntropyBits(const uint32_t* freq_table1, const uint32_t* freq_table2) {
+    double total1 = 0;
+    double total2 = 0;
+    double bits = 0;
+
+    for (int c = 0; c < kHuffmanCodes1; c++) {
+        total1 += freq_table1[c];
+    }
+    for (int c = 0; c < kHuffmanCodes2; c++) {
+        total2 += freq_table2[c];
+    }
+    for (int c = 0; c < kHuffmanCodes1; c++) {
+        bits += (freq_table1[c] > 0) ? freq_table1[c] * log2(total1 / freq_table1[c]) : 0;
+    }
+    for (int c = 0; c < kHuffmanCodes2; c++) {
+        bits += (freq_table2[c] > 0) ? freq_table2[c] * log2(total2 / freq_table2[c]) : 0;
+    }
+    return bits;
+}
+
+/* SplitBlock: choose sub-block boundaries, greedy over segments of kSplitSegmentSize symbols,
+ *  a segment starts a new sub-block if coding it separately saves more than its own tables cost.
+ *  arg tbuf:   rolz symbols
+ *  arg rlen:   number of symbols
+ *  arg splits: end of each sub-block, the last one is rlen
+ *  return:     number of sub-blocks
+ */
+static inline int SplitBlock(const uint16_t* tbuf, int rlen, int* splits) {
+    static const double kTableBits = (kHuffmanTableSize + (kHuffmanStreams - 1) * 4) * 8;
+    uint32_t group_table1[kHuffmanCodes1] = {0};
+    uint32_t group_table2[kHuffmanCodes2] = {0};
+    double group_bits = 0;
+    int nsplits = 0;
+
+    for (int i = 0; i < rlen; ) {
+        uint32_t freq_table1[kHuffmanCodes1] = {0};
+        uint32_t freq_table2[kHuffmanCodes2] = {0};
+        int start = i;
+
+        for (; i < rlen && i - start < kSplitSegmentSize; i++) {
+            freq_table1[tbuf[i]] += 1;
+            if (tbuf[i] >= 256) {
+                freq_table2[IdxToCode(tbuf[++i])] += 1;
+            }
+        }
+        double bits = GetEntropyBits(freq_table1, freq_table2);
+
+        for (int c = 0; c < kHuffmanCodes1; c++) {
+            freq_table1[c] += group_table1[c];
+        }
+        for (int c = 0; c < kHuffmanCodes2; c++) {
+            freq_table2[c] += group_table2[c];
+        }
+        double merged_bits = GetEntropyBits(freq_table1, freq_table2);
+
+        if (start > 0 && merged_bits - group_bits - bits > kTableBits * 1.5) {  // new sub-block (entropy is optimistic)
+            splits[nsplits++] = start;
+            for (int c = 0; c < kHuffmanCodes1; c++) {
+                group_table1[c] = freq_table1[c] - group_table1[c];
+            }
+            for (int c = 0; c < kHuffmanCodes2; c++) {
+                group_table2[c] = freq_table2[c] - group_table2[c];
+            }
+            group_bits = bits;
+        } else {
+            memcpy(group_table1, freq_table1, sizeof(group_table1));
+            memcpy(group_table2, freq_table2, sizeof(group_table2));
+            group_bits = merged_bits;
+        }
+    }
+    splits[nsplits++] = rlen;
+    return nsplits;
+}
+
+// tables are built once at load time, before any encoder/decoder thread is started.
+static struct ZlingCodeTablesInitializer {
+    ZlingCodeTablesInitializer() {
+        InitMatchidxCode();
+        InitStaticTables();
+    }
+} code_tables_initializer;
+
+static inline double GetWallTime() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static inline uint32_t GetUInt32(const unsigned char* buf) {
+    return buf[0] * 16777216u + buf[1] * 65536u + buf[2] * 256u + buf[3];
+}
+static inline void PutUInt32(unsigned char* buf, uint32_t x) {
+    buf[0] = x / 16777216 % 256;
+    buf[1] = x / 65536 % 256;
+    buf[2] = x / 256 % 256;
+    buf[3] = x % 256;
+    return;
+}
+
+// ReserveDictBuffer: grow a dictionary buffer to size bytes, keeping the dictionary in front.
+static inline void ReserveDictBuffer(unsigned char** dbuf, int* dbufsize, int dictlen, int size) {
+    if (*dbufsize < size) {
+        unsigned char* newbuf = new unsigned char[size];
+        memcpy(newbuf, *dbuf, dictlen);
+        delete [] *dbuf;
+        *dbuf = newbuf;
+        *dbufsize = size;
+    }
+    return;
+}
+
+ZlingRoundEncoder::ZlingRoundEncoder() {
+    m_lzencoder = new ZlingRolzEncoder();
+    m_tbuf = new uint16_t[kBlockSizeRolz];
+    m_ring = NULL;
+    m_pipeline = false;
+    m_tables = new ZlingEncodeTables();
+    m_tables_valid = false;
+    m_checksum = false;
+    ResetStageTimes();
+    m_dbuf = NULL;
+    m_dbufsize = 0;
+    m_dictlen = 0;
+    m_dictid = 0;
+}
+
+ZlingRoundEncoder::~ZlingRoundEncoder() {
+    delete m_lzencoder;
+    delete [] m_tbuf;
+    delete [] m_ring;
+    delete m_tables;
+    delete [] m_dbuf;
+}
+
+int ZlingRoundEncoder::SetDictionary(const unsigned char* dict, int len) {
+    if (len < 0 || len > kDictMaxSize) {
+        return -1;
+    }
+    m_dictlen = 0;  // keep nothing when growing
+    ReserveDictBuffer(&m_dbuf, &m_dbufsize, 0, len + kBlockSizeRolz);
+    if (len > 0) {
+        memcpy(m_dbuf, dict, len);
+    }
+    m_dictlen = len;
+    m_dictid = ZlingDictionaryId(dict, len);
+    m_lzencoder->SetDictionary(dict, len);
+    return 0;
+}
+
+// ZlingEncodeJob: a block passed from rolz stage to huffman stage.
+struct ZlingEncodeJob {
+    uint16_t* tbuf;       // rolz symbols
+    int       rlen;
+    int       ipos;       // input data of the block
+    int       ilen;
+    bool      stored;     // incompressible, copied as is
+    double    time_rolz;
+#if ZLING_STATS
+    lz::ZlingRolzStats rolz;  // match finder counters of the block
+#endif
+};
+
+// pipeline: jobs go through a ring of kPipelineSlots token buffers from a producer stage to a
+//  consumer stage in another thread, in order, so the two stages of consecutive blocks overlap.
+static const int kPipelineSlots = 3;
+
+struct ZlingPipeline {
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    int             produced;
+    int             consumed;
+    bool            closed;  // no more jobs from producer
+};
+
+/* StartPipeline: start pipeline thread.
+ *  arg thread: thread function, runs one of the stages
+ *  arg arg:    thread function argument
+ *  return:     false if no thread can be created (run without pipeline then)
+ */
+static bool StartPipeline(ZlingPipeline* pipeline, void* (*thread)(void*), void* arg) {
+    pipeline->produced = 0;
+    pipeline->consumed = 0;
+    pipeline->closed = false;
+    pthread_mutex_init(&pipeline->mutex, NULL);
+    pthread_cond_init(&pipeline->cond, NULL);
+
+    if (pthread_create(&pipeline->thread, NULL, thread, arg) != 0) {
+        pthread_mutex_destroy(&pipeline->mutex);
+        pthread_cond_destroy(&pipeline->cond);
+        return false;
+    }
+    return true;
+}
+
+// WaitPipelineSlot: producer waits until slot (produced % kPipelineSlots) is no longer used by the consumer.
+static void WaitPipelineSlot(ZlingPipeline* pipeline) {
+    pthread_mutex_lock(&pipeline->mutex);
+    while (pipeline->produced - pipeline->consumed == kPipelineSlots) {
+        pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+    }
+    pthread_mutex_unlock(&pipeline->mutex);
+    return;
+}
+
+// PushPipelineJob: producer has filled slot (produced % kPipelineSlots).
+static void PushPipelineJob(ZlingPipeline* pipeline) {
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->produced += 1;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+    return;
+}
+
+// ClosePipeline: producer pushes no more jobs.
+static void ClosePipeline(ZlingPipeline* pipeline) {
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->closed = true;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+    return;
+}
+
+// WaitPipelineJob: consumer waits for slot (consumed % kPipelineSlots).
+//  return: false if the pipeline is closed and all jobs are consumed
+static bool WaitPipelineJob(ZlingPipeline* pipeline) {
+    pthread_mutex_lock(&pipeline->mutex);
+    while (pipeline->consumed == pipeline->produced && !pipeline->closed) {
+        pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+    }
+    bool ready = (pipeline->consumed != pipeline->produced);
+    pthread_mutex_unlock(&pipeline->mutex);
+    return ready;
+}
+
+// PopPipelineJob: consumer is done with slot (consumed % kPipelineSlots).
+static void PopPipelineJob(ZlingPipeline* pipeline) {
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->consumed += 1;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+    return;
+}
+
+// JoinPipeline: wait for the pipeline thread to return.
+static void JoinPipeline(ZlingPipeline* pipeline) {
+    pthread_join(pipeline->thread, NULL);
+    pthread_mutex_destroy(&pipeline->mutex);
+    pthread_cond_destroy(&pipeline->cond);
+    return;
+}
+
+// encoder pipeline: rolz stage in caller thread, huffman stage in pipeline thread.
+struct ZlingEncodePipeline {
+    ZlingPipeline  pipeline;
+    ZlingEncodeJob jobs[kPipelineSlots];
+
+    // huffman stage output, owned by the pipeline thread until joined
+    ZlingRoundEncoder*   encoder;
+    const unsigned char* ibuf;
+    unsigned char*       obuf;
+    int                  opos;
+};
+
+#if ZLING_STATS
+static inline lz::ZlingRolzStats SubRolzStats(const lz::ZlingRolzStats& x, const lz::ZlingRolzStats& y) {
+    lz::ZlingRolzStats stats;
+
+    stats.match_calls = x.match_calls - y.match_calls;
+    stats.chain_nodes = x.chain_nodes - y.chain_nodes;
+    stats.check_rejects = x.check_rejects - y.check_rejects;
+    stats.discards = x.discards - y.discards;
+    return stats;
+}
+#endif
+
+static inline void PutBlockHeader(unsigned char* buf, int flag, int rlen, int olen) {
+    buf[0] = flag;
+    buf[1] = rlen / 16777216 % 256;
+    buf[2] = olen / 16777216 % 256;
+    buf[3] = rlen / 65536 % 256;
+    buf[4] = olen / 65536 % 256;
+    buf[5] = rlen / 256 % 256;
+    buf[6] = olen / 256 % 256;
+    buf[7] = rlen % 256;
+    buf[8] = olen % 256;
+    return;
+}
+
+static inline void GetBlockHeader(const unsigned char* buf, uint32_t* rlen, uint32_t* olen) {
+    *rlen = buf[1] * 16777216u + buf[3] * 65536u + buf[5] * 256u + buf[7];
+    *olen = buf[2] * 16777216u + buf[4] * 65536u + buf[6] * 256u + buf[8];
+    return;
+}
+
+int ZlingRoundEncoder::Encode(const unsigned char* ibuf, int ilen, unsigned char* obuf) {
+    int encpos = 0;
+    int opos = 0;
+    int dlen = ilen;
+    int checksum_pos = 0;
+    uint32_t crc = 0;
+
+    obuf[opos++] = kFlagRoundSized;  // flag: start rolz round
+    opos += 8;
+    m_lzencoder->Reset();
+    m_tables_valid = false;
+#if ZLING_STATS
+    m_block_stats.clear();
+#endif
+
+    // checksum: filled after all blocks
+    if (m_checksum) {
+        checksum_pos = opos;
+        obuf[opos++] = kFlagRoundChecksum;
+        opos += 4;
+    }
+
+    // dictionary: encode (dictionary + input), with the dictionary already in rolz buckets
+    if (m_dictlen > 0 && ilen <= kBlockSizeIn - m_dictlen) {
+        ReserveDictBuffer(&m_dbuf, &m_dbufsize, m_dictlen, m_dictlen + ilen + 16);
+        memcpy(m_dbuf + m_dictlen, ibuf, ilen);
+        m_lzencoder->Reset(true);
+
+        obuf[opos++] = kFlagRoundDict;
+        PutUInt32(obuf + opos, m_dictid), opos += 4;
+        PutUInt32(obuf + opos, m_dictlen), opos += 4;
+        ibuf = m_dbuf;
+        ilen += m_dictlen;
+        encpos = m_dictlen;
+    }
+
+    // pipeline: not worth a thread for a single block
+    ZlingEncodePipeline pipeline;
+    pipeline.encoder = this;
+    pipeline.ibuf = ibuf;
+    pipeline.obuf = obuf;
+    pipeline.opos = opos;
+    bool pipelined = m_pipeline && ilen - encpos > kBlockSizeRolz
+        && StartPipeline(&pipeline.pipeline, PipelineThread, &pipeline);
+
+    if (pipelined && m_ring == NULL) {
+        m_ring = new uint16_t[kPipelineSlots * kBlockSizeRolz];
+    }
+    for (int nblocks = 0; encpos < ilen; nblocks++) {
+        ZlingEncodeJob job = ZlingEncodeJob();
+        int stored_len = std::min(ilen - encpos, kBlockSizeRolz);
+#if ZLING_STATS
+        lz::ZlingRolzStats rolz_start = m_lzencoder->GetStats();
+#endif
+        job.tbuf = pipelined ? m_ring + nblocks % kPipelineSlots * kBlockSizeRolz : m_tbuf;
+        job.ipos = encpos;
+        if (pipelined) {
+            WaitPipelineSlot(&pipeline.pipeline);
+        }
+
+        // STORED: incompressible block, skip both stages
+        // ROLZ encode
+        // ============================================================
+        if (IsIncompressible(ibuf + encpos, stored_len)) {
+            job.stored = true;
+            encpos += stored_len;
+        } else {
+            double time_rolz = GetWallTime();
+            job.rlen = m_lzencoder->Encode(ibuf, job.tbuf, ilen, kBlockSizeRolz, &encpos);
+            job.time_rolz = GetWallTime() - time_rolz;
+            m_times.rolz += job.time_rolz;
+        }
+        job.ilen = encpos - job.ipos;
+        if (m_checksum) {  // block data is still in cache
+            crc = ZlingCrc32c(crc, ibuf + job.ipos, job.ilen);
+        }
+#if ZLING_STATS
+        job.rolz = SubRolzStats(m_lzencoder->GetStats(), rolz_start);
+#endif
+
+        // HUFFMAN encode (in pipeline thread if pipelined)
+        // ============================================================
+        if (pipelined) {
+            pipeline.jobs[nblocks % kPipelineSlots] = job;
+            PushPipelineJob(&pipeline.pipeline);
+        } else {
+            opos += EncodeBlock(job, ibuf, obuf + opos);
+        }
+    }
+    if (pipelined) {
+        ClosePipeline(&pipeline.pipeline);
+        JoinPipeline(&pipeline.pipeline);
+        opos = pipeline.opos;
+    }
+
+    if (m_checksum) {
+        PutUInt32(obuf + checksum_pos + 1, crc);
+    }
+
+    // round header: body size and decoded size
+    PutUInt32(obuf + 1, opos - kRoundHeaderSize);
+    PutUInt32(obuf + 5, dlen);
+    return opos;
+}
+
+/* EncodeBlock: huffman stage of a block, stored blocks are copied.
+ *  arg job:    block from rolz stage
+ *  arg obuf:   output data (block headers and huffman blocks)
+ *  return:     output data length
+ */
+int ZlingRoundEncoder::EncodeBlock(const ZlingEncodeJob& job, const unsigned char* ibuf, unsigned char* obuf) {
+    int opos = 0;
+
+    if (job.stored) {
+        memcpy(obuf + kBlockHeaderSize, ibuf + job.ipos, job.ilen);
+        PutBlockHeader(obuf, kFlagRoundBlockStored, job.ilen, job.ilen);
+#if ZLING_STATS
+        m_block_stats.push_back(MakeBlockStats(kFlagRoundBlockStored, job.ilen, job.ilen, job.tbuf, 0, job.rolz));
+#endif
+        return kBlockHeaderSize + job.ilen;
+    }
+
+    // one huffman block per sub-block of symbols
+    double time_huffman = GetWallTime();
+    int splits[kSplitMaxBlocks];
+    int nsplits = SplitBlock(job.tbuf, job.rlen, splits);
+
+    for (int i = 0, start = 0; i < nsplits; start = splits[i++]) {
+        int flag;
+#if ZLING_STATS
+        double time_block = (i == 0) ? time_huffman : GetWallTime();
+#endif
+        int olen = EncodeHuffman(job.tbuf + start, splits[i] - start, obuf + opos + kBlockHeaderSize, &flag);
+
+        PutBlockHeader(obuf + opos, flag, splits[i] - start, olen);
+        opos += kBlockHeaderSize + olen;
+#if ZLING_STATS
+        // rolz stats/time go to the first sub-block
+        m_block_stats.push_back(MakeBlockStats(
+            flag, 0, olen, job.tbuf + start, splits[i] - start, (i == 0) ? job.rolz : lz::ZlingRolzStats()));
+        m_block_stats.back().times.rolz = (i == 0) ? job.time_rolz : 0;
+        m_block_stats.back().times.huffman = GetWallTime() - time_block;
+#endif
+    }
+    m_times.huffman += GetWallTime() - time_huffman;
+    return opos;
+}
+
+void* ZlingRoundEncoder::PipelineThread(void* arg) {
+    ZlingEncodePipeline* pipeline = static_cast<ZlingEncodePipeline*>(arg);
+
+    while (WaitPipelineJob(&pipeline->pipeline)) {
+        const ZlingEncodeJob& job = pipeline->jobs[pipeline->pipeline.consumed % kPipelineSlots];
+        pipeline->opos += pipeline->encoder->EncodeBlock(job, pipeline->ibuf, pipeline->obuf + pipeline->opos);
+        PopPipelineJob(&pipeline->pipeline);
+    }
+    return NULL;
+}
+
+void ZlingRoundEncoder::SetLevel(int level) {
+    m_lzencoder->SetLevel(level);
+    return;
+}
+
+#if ZLING_STATS
+ZlingBlockStats ZlingRoundEncoder::MakeBlockStats(
+    int flag, int ilen, int olen, const uint16_t* tbuf, int rlen, const lz::ZlingRolzStats& rolz) {
+    ZlingBlockStats stats = ZlingBlockStats();
+
+    stats.flag = flag;
+    stats.ilen = ilen;
+    stats.olen = olen;
+    stats.symbols = rlen;
+    for (int i = 0; i < rlen; i++) {
+        if (tbuf[i] >= 256) {
+            stats.matches += 1;
+            stats.match_bytes += tbuf[i++] - 256 + kMatchMinLen;
+        } else {
+            stats.literals += 1;
+        }
+    }
+    if (rlen > 0) {  // input bytes of a huffman block
+        stats.ilen = stats.literals + stats.match_bytes;
+    }
+    if (flag == kFlagRoundBlockInterleaved) {
+        stats.table_bits = (kHuffmanTableSize + (kHuffmanStreams - 1) * 4) * 8;
+    }
+    if (flag == kFlagRoundBlockRepeat) {
+        stats.table_bits = (kHuffmanStreams - 1) * 4 * 8;
+    }
+    stats.payload_bits = olen * 8 - stats.table_bits;
+    stats.rolz = rolz;
+    return stats;
+}
+#endif
+
+int ZlingRoundEncoder::EncodeHuffman(const uint16_t* tbuf, int rlen, unsigned char* obuf, int* flag) {
+    int opos = 0;
+    int nstreams = kHuffmanStreams;
+    uint32_t freq_table1[kHuffmanCodes1] = {0};
+    uint32_t freq_table2[kHuffmanCodes2] = {0};
+    ZlingEncodeTables* tables = NULL;
+
+    for (int i = 0; i < rlen; i++) {
+        freq_table1[tbuf[i]] += 1;
+        if (tbuf[i] >= 256) {
+            freq_table2[IdxToCode(tbuf[++i])] += 1;
+        }
+    }
+
+    // small block: use static tables if they cost no more than the entropy plus own tables
+    if (rlen <= kStaticMaxSymbols) {
+        double total1 = 0;
+        double total2 = 0;
+        double static_bits = GetCodeBits(freq_table1, freq_table2, static_encode_tables);
+        double dynamic_bits = (kHuffmanTableSize + (kHuffmanStreams - 1) * 4) * 8;
+
+        for (int c = 0; c < kHuffmanCodes1; c++) {
+            total1 += freq_table1[c];
+        }
+        for (int c = 0; c < kHuffmanCodes2; c++) {
+            total2 += freq_table2[c];
+        }
+        for (int c = 0; c < kHuffmanCodes1; c++) {
+            dynamic_bits += (freq_table1[c] > 0) ? freq_table1[c] * log2(total1 / freq_table1[c]) : 0;
+        }
+        for (int c = 0; c < kHuffmanCodes2; c++) {
+            dynamic_bits += (freq_table2[c] > 0) ? freq_table2[c] * log2(total2 / freq_table2[c]) : 0;
+        }
+        if (static_bits <= dynamic_bits) {
+            tables = &static_encode_tables;
+            nstreams = 1;
+            *flag = kFlagRoundBlockStatic;
+        }
+    }
+
+    if (tables == NULL) {
+        ZlingEncodeTables new_tables;
+        MakeEncodeTables(freq_table1, freq_table2, &new_tables);
+
+        // previous tables: reuse them if they cost (almost) no more than new tables, so the
+        //  decoder can skip building its tables.
+        double new_bits = GetCodeBits(freq_table1, freq_table2, new_tables) + kHuffmanTableSize * 8;
+        double old_bits = m_tables_valid ? GetCodeBits(freq_table1, freq_table2, *m_tables) : -1;
+
+        tables = m_tables;
+        if (old_bits >= 0 && old_bits <= new_bits + new_bits / 256) {
+            *flag = kFlagRoundBlockRepeat;
+        } else {
+            memcpy(m_tables, &new_tables, sizeof(new_tables));
+            m_tables_valid = true;
+
+            // write length table
+            for (int i = 0; i < kHuffmanCodes1; i += 2) {
+                obuf[opos++] = tables->length_table1[i] * 16 + tables->length_table1[i + 1];
+            }
+            for (int i = 0; i < kHuffmanCodes2; i += 2) {
+                obuf[opos++] = tables->length_table2[i] * 16 + tables->length_table2[i + 1];
+            }
+            if (opos % 4 != 0) obuf[opos++] = 0;  // keep aligned
+            if (opos % 4 != 0) obuf[opos++] = 0;  // keep aligned
+            if (opos % 4 != 0) obuf[opos++] = 0;  // keep aligned
+            if (opos % 4 != 0) obuf[opos++] = 0;  // keep aligned
+            *flag = kFlagRoundBlockInterleaved;
+        }
+    }
+    const uint32_t* length_table1 = tables->length_table1;
+    const uint32_t* length_table2 = tables->length_table2;
+    const uint16_t* encode_table1 = tables->encode_table1;
+    const uint16_t* encode_table2 = tables->encode_table2;
+
+    // interleaved streams: token k (a literal, or a match symbol with its index) goes to stream
+    //  k % nstreams, sizes of all streams but the last are stored before them.
+    int sizepos = opos;
+    opos += (nstreams - 1) * 4;
+
+    for (int stream = 0; stream < nstreams; stream++) {
+        ZlingCodebuf codebuf;
+        int start = opos;
+
+        for (int i = 0, k = 0; i < rlen; i++, k++) {
+            bool selected = (k % nstreams == stream);
+
+            if (selected) {
+                codebuf.Input(encode_table1[tbuf[i]], length_table1[tbuf[i]]);
+            }
+            if (tbuf[i] >= 256) {
+                i++;
+                if (selected) {
+                    codebuf.Input(
+                        encode_table2[IdxToCode(tbuf[i])],
+                        length_table2[IdxToCode(tbuf[i])]);
+                    codebuf.Input(
+                        IdxToBits(tbuf[i]),
+                        IdxToBitlen(tbuf[i]));
+                }
+            }
+            while (codebuf.GetLength() >= 32) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                *reinterpret_cast<uint32_t*>(obuf + opos) = codebuf.Output(32);
+                opos += 4;
+#else
+                obuf[opos++] = codebuf.Output(8);
+                obuf[opos++] = codebuf.Output(8);
+                obuf[opos++] = codebuf.Output(8);
+                obuf[opos++] = codebuf.Output(8);
+#endif
+            }
+        }
+        while (codebuf.GetLength() > 0) {
+            obuf[opos++] = codebuf.Output(8);
+        }
+        if (stream + 1 < nstreams) {
+            PutUInt32(obuf + sizepos + stream * 4, opos - start);
+        }
+    }
+    return opos;
+}
+
+struct ZlingDecodeJob {
+    uint16_t*            tbuf;  // rolz symbols
+    int                  rlen;
+    int                  dlen;  // decoded data length
+    const unsigned char* data;  // data of stored block
+    bool                 stored;
+};
+
+// decoder pipeline: huffman stage in pipeline thread, rolz stage in caller thread.
+struct ZlingDecodePipeline {
+    ZlingPipeline  pipeline;
+    ZlingDecodeJob jobs[kPipelineSlots];
+
+    // huffman stage input, owned by the pipeline thread until joined
+    ZlingRoundDecoder*   decoder;
+    const unsigned char* ibuf;
+    int                  ilen;
+    int                  olen;
+    int                  stop;
+    int                  ipos;    // input position after pushed jobs, -1 on corrupted block
+    int                  decpos;  // output position after pushed jobs
+};
+
+ZlingRoundDecoder::ZlingRoundDecoder() {
+    m_lzdecoder = new ZlingRolzDecoder();
+    m_tbuf = new uint16_t[kBlockSizeRolz + 1];  // +1: corrupted block may end with a match symbol
+    m_ring = NULL;
+    m_pipeline = false;
+    m_tables = new ZlingDecodeTables();
+    m_sink = NULL;
+    m_sink_arg = NULL;
+    m_tables_valid = false;
+    m_checksum = false;
+    m_crc = 0;
+    ResetStageTimes();
+    m_dbuf = NULL;
+    m_dbufsize = 0;
+    m_dictlen = 0;
+    m_dictid = 0;
+}
+
+ZlingRoundDecoder::~ZlingRoundDecoder() {
+    delete m_lzdecoder;
+    delete [] m_tbuf;
+    delete [] m_ring;
+    delete m_tables;
+    delete [] m_dbuf;
+}
+
+int ZlingRoundDecoder::SetDictionary(const unsigned char* dict, int len) {
+    if (len < 0 || len > kDictMaxSize) {
+        return -1;
+    }
+    m_dictlen = 0;  // keep nothing when growing
+    ReserveDictBuffer(&m_dbuf, &m_dbufsize, 0, len + kBlockSizeRolz);
+    if (len > 0) {
+        memcpy(m_dbuf, dict, len);
+    }
+    m_dictlen = len;
+    m_dictid = ZlingDictionaryId(dict, len);
+    m_lzdecoder->SetDictionary(dict, len);
+    return 0;
+}
+
+void ZlingRoundDecoder::Reset() {
+    m_lzdecoder->Reset();
+    m_tables_valid = false;
+    return;
+}
+
+int ZlingRoundDecoder::Decode(const unsigned char* ibuf, int ilen, unsigned char* obuf, int olen, int stop) {
+    int decpos = 0;
+    uint32_t crc = 0;
+
+    Reset();
+    m_checksum = (ilen >= kChecksumHeaderSize && ibuf[0] == kFlagRoundChecksum);
+    m_crc = 0;
+    if (m_checksum) {
+        crc = GetUInt32(ibuf + 1);
+        ibuf += kChecksumHeaderSize;
+        ilen -= kChecksumHeaderSize;
+    }
+    if (ilen >= kBlockHeaderSize && ibuf[0] == kFlagRoundDict) {
+        if (m_dictlen == 0 || GetUInt32(ibuf + 1) != m_dictid || GetUInt32(ibuf + 5) != uint32_t(m_dictlen)) {
+            return -1;  // no dictionary or a different one
+        }
+
+        // decode after the dictionary, then move decoded data to obuf
+        olen = std::min(olen, kBlockSizeIn - m_dictlen);
+        stop = std::min(stop, olen);
+        ReserveDictBuffer(&m_dbuf, &m_dbufsize, m_dictlen, m_dictlen + olen);
+        m_lzdecoder->Reset(true);
+
+        decpos = m_dictlen;
+        int size = DecodeBlocks(ibuf + kBlockHeaderSize,
+                                ilen - kBlockHeaderSize,
+                                m_dbuf,
+                                m_dictlen + olen,
+                                m_dictlen + stop,
+                                &decpos);
+        if (size == -1 || (m_checksum && size == ilen - kBlockHeaderSize && m_crc != crc)) {
+            return -1;
+        }
+        memcpy(obuf, m_dbuf + m_dictlen, decpos - m_dictlen);
+        if (m_sink != NULL && m_checksum) {
+            m_sink(obuf, decpos - m_dictlen, m_sink_arg);
+        }
+        return decpos - m_dictlen;
+    }
+
+    // checksum is verified only if the whole round is decoded
+    int size = DecodeBlocks(ibuf, ilen, obuf, olen, stop, &decpos);
+    if (size == -1 || (m_checksum && size == ilen && m_crc != crc)) {
+        return -1;
+    }
+    if (m_sink != NULL && m_checksum) {  // held back until verified
+        m_sink(obuf, decpos, m_sink_arg);
+    }
+    return decpos;
+}
+
+int ZlingRoundDecoder::DecodeBlocks(
+    const unsigned char* ibuf, int ilen, unsigned char* obuf, int olen, int stop, int* decpos) {
+    int ipos = 0;
+    uint32_t rlen;
+    uint32_t blen;
+
+    // pipeline: not worth a thread for a single block
+    ZlingDecodePipeline pipeline;
+    bool pipelined = false;
+
+    if (m_pipeline && ilen >= kBlockHeaderSize && *decpos < stop) {
+        GetBlockHeader(ibuf, &rlen, &blen);
+        if (blen < uint32_t(ilen - kBlockHeaderSize)) {
+            if (m_ring == NULL) {
+                m_ring = new uint16_t[kPipelineSlots * (kBlockSizeRolz + 1)];
+            }
+            pipeline.decoder = this;
+            pipeline.ibuf = ibuf;
+            pipeline.ilen = ilen;
+            pipeline.olen = olen;
+            pipeline.stop = stop;
+            pipeline.ipos = 0;
+            pipeline.decpos = *decpos;
+            pipelined = StartPipeline(&pipeline.pipeline, PipelineThread, &pipeline);
+        }
+    }
+
+    if (!pipelined) {
+        ZlingDecodeJob job;
+        job.tbuf = m_tbuf;
+
+        while (ipos < ilen && *decpos < stop) {
+            if (DecodeBlockHuffman(ibuf, ilen, &ipos, olen, *decpos, &job) == -1) {
+                return -1;
+            }
+            DecodeBlockRolz(job, obuf, olen, decpos);
+        }
+        return ipos;
+    }
+
+    // ROLZ decode of blocks from pipeline thread, in order
+    while (WaitPipelineJob(&pipeline.pipeline)) {
+        DecodeBlockRolz(pipeline.jobs[pipeline.pipeline.consumed % kPipelineSlots], obuf, olen, decpos);
+        PopPipelineJob(&pipeline.pipeline);
+    }
+    JoinPipeline(&pipeline.pipeline);
+    return pipeline.ipos;
+}
+
+void* ZlingRoundDecoder::PipelineThread(void* arg) {
+    ZlingDecodePipeline* pipeline = static_cast<ZlingDecodePipeline*>(arg);
+    ZlingRoundDecoder* decoder = pipeline->decoder;
+
+    for (int nblocks = 0; pipeline->ipos < pipeline->ilen && pipeline->decpos < pipeline->stop; nblocks++) {
+        ZlingDecodeJob* job = &pipeline->jobs[nblocks % kPipelineSlots];
+
+        WaitPipelineSlot(&pipeline->pipeline);
+        job->tbuf = decoder->m_ring + nblocks % kPipelineSlots * (kBlockSizeRolz + 1);
+        if (decoder->DecodeBlockHuffman(
+                pipeline->ibuf, pipeline->ilen, &pipeline->ipos, pipeline->olen, pipeline->decpos, job) == -1) {
+            pipeline->ipos = -1;
+            break;
+        }
+        pipeline->decpos += job->dlen;  // rolz stage decodes exactly dlen bytes
+        PushPipelineJob(&pipeline->pipeline);
+    }
+    ClosePipeline(&pipeline->pipeline);
+    return NULL;
+}
+
+/* DecodeBlockHuffman: huffman stage of a block, checks everything the rolz stage relies on.
+ *  arg ipos:   block position in ibuf, updated to the next block
+ *  arg decpos: output position of the block
+ *  arg job:    rolz symbols (to job->tbuf) or stored data of the block
+ *  return:     0, -1 on corrupted block
+ */
+int ZlingRoundDecoder::DecodeBlockHuffman(
+    const unsigned char* ibuf, int ilen, int* ipos, int olen, int decpos, ZlingDecodeJob* job) {
+    uint32_t rlen;
+    uint32_t blen;
+
+    int flag = ibuf[*ipos];
+    if (flag != kFlagRoundBlock
+            && flag != kFlagRoundBlockInterleaved
+            && flag != kFlagRoundBlockStatic
+            && flag != kFlagRoundBlockRepeat
+            && flag != kFlagRoundBlockStored) {
+        return -1;
+    }
+    if (ilen - *ipos < kBlockHeaderSize) {
+        return -1;
+    }
+    GetBlockHeader(ibuf + *ipos, &rlen, &blen);
+    *ipos += kBlockHeaderSize;
+
+    if (rlen > uint32_t(kBlockSizeRolz) || blen > uint32_t(kBlockSizeHuffman) || blen > uint32_t(ilen - *ipos)) {
+        return -1;
+    }
+    job->rlen = rlen;
+    job->stored = (flag == kFlagRoundBlockStored);
+
+    // STORED: copied by rolz stage, bytes are not added to rolz buckets (neither by the encoder)
+    // ============================================================
+    if (job->stored) {
+        if (blen != rlen || int(rlen) > olen - decpos) {
+            return -1;
+        }
+        job->data = ibuf + *ipos;
+        job->dlen = rlen;
+        *ipos += blen;
+        return 0;
+    }
+
+    // HUFFMAN decode
+    // ============================================================
+    double time_huffman = GetWallTime();
+    job->dlen = DecodeHuffman(ibuf + *ipos, blen, rlen, flag, job->tbuf);
+    if (job->dlen == -1 || job->dlen > olen - decpos) {
+        return -1;
+    }
+    if (decpos == 0 && rlen > 0 && job->tbuf[0] >= 256) {  // first symbol of a round must be literal
+        return -1;
+    }
+    *ipos += blen;
+    m_times.huffman += GetWallTime() - time_huffman;
+    return 0;
+}
+
+// DecodeBlockRolz: rolz stage of a block checked by DecodeBlockHuffman(), stored blocks are copied.
+void ZlingRoundDecoder::DecodeBlockRolz(const ZlingDecodeJob& job, unsigned char* obuf, int olen, int* decpos) {
+    double time_rolz = GetWallTime();
+    int start = *decpos;
+
+    // ROLZ decode
+    // ============================================================
+    if (job.stored) {
+        memcpy(obuf + *decpos, job.data, job.rlen);
+        *decpos += job.rlen;
+    } else {
+        m_lzdecoder->Decode(job.tbuf, obuf, job.rlen, olen, decpos);
+    }
+
+    if (m_checksum) {  // block data is still in cache
+        m_crc = ZlingCrc32c(m_crc, obuf + start, *decpos - start);
+    }
+    if (!job.stored) {
+        m_times.rolz += GetWallTime() - time_rolz;
+    }
+    if (m_sink != NULL && !m_checksum) {  // rounds with checksum are passed by Decode() once verified
+        m_sink(obuf + start, *decpos - start, m_sink_arg);
+    }
+    return;
+}
+
+/* DecodeToken: decode one literal, or one match symbol with its index, from a stream.
+ *  arg ipos:   stream position, updated
+ *  arg iend:   stream end
+ *  arg tbuf:   output symbols (1 or 2)
+ *  return:     decoded data length of the token, -1 on corrupted stream
+ */
+static inline int DecodeToken(const ZlingDecodeTables& tables,
+                              ZlingCodebuf* codebuf,
+                              const unsigned char* ibuf,
+                              int* ipos,
+                              int iend,
+                              uint16_t* tbuf) {
+    if (*ipos > iend + 8) {  // corrupted: reading far beyond the stream
+        return -1;
+    }
+    *ipos += codebuf->Refill(ibuf + *ipos);
+
+    uint32_t entry = tables.table1_fast[codebuf->Peek(kHuffmanMaxLen1Fast)];
+    if (entry == kPackedInvalid) {
+        entry = tables.table1[codebuf->Peek(kHuffmanMaxLen1)];
+        if (entry == kPackedInvalid) {  // corrupted: invalid code
+            return -1;
+        }
+    }
+    codebuf->Output(entry >> kPackedLenShift);
+    tbuf[0] = entry & ((1 << kPackedLenShift) - 1);
+
+    if (tbuf[0] >= 256) {
+        uint32_t code = tables.table2[codebuf->Peek(kHuffmanMaxLen2)];
+        if (code == uint32_t(-1)) {  // corrupted: invalid code
+            return -1;
+        }
+        uint32_t codelen = code >> 16 & 0xff;
+        uint32_t bitlen = codelen + (code >> 24);
+        tbuf[1] = (code & 0xffff) | codebuf->Output(bitlen) >> codelen;
+        return tbuf[0] - 256 + kMatchMinLen;
+    }
+    return 1;
+}
+
+int ZlingRoundDecoder::DecodeHuffman(const unsigned char* ibuf, int ilen, int rlen, int flag, uint16_t* tbuf) {
+    ZlingCodebuf codebuf0;
+    ZlingCodebuf codebuf1;
+    ZlingCodebuf codebuf2;
+    ZlingCodebuf codebuf3;
+    const ZlingDecodeTables& tables = (flag == kFlagRoundBlockStatic) ? static_decode_tables : *m_tables;
+    int nstreams = (flag == kFlagRoundBlockInterleaved || flag == kFlagRoundBlockRepeat) ? kHuffmanStreams : 1;
+    int ipos[kHuffmanStreams];
+    int iend[kHuffmanStreams];
+    int opos = 0;
+    int dlen = 0;
+    uint32_t length_table1[kHuffmanCodes1] = {0};
+    uint32_t length_table2[kHuffmanCodes2] = {0};
+
+    if (flag == kFlagRoundBlockStatic) {  // static tables: one stream, no length table
+        ipos[0] = 0;
+        iend[0] = ilen;
+        nstreams = 1;
+    } else {
+        bool repeat = (flag == kFlagRoundBlockRepeat);
+        if (repeat && !m_tables_valid) {  // corrupted: no tables to repeat
+            return -1;
+        }
+        if (ilen < (repeat ? 0 : kHuffmanTableSize) + (nstreams - 1) * 4) {  // corrupted: truncated tables
+            return -1;
+        }
+
+        // read length table
+        for (int i = 0; !repeat && i < kHuffmanCodes1; i += 2) {
+            length_table1[i] =     ibuf[opos] / 16;
+            length_table1[i + 1] = ibuf[opos] % 16;
+            opos++;
+        }
+        for (int i = 0; !repeat && i < kHuffmanCodes2; i += 2) {
+            length_table2[i] =     ibuf[opos] / 16;
+            length_table2[i + 1] = ibuf[opos] % 16;
+            opos++;
+        }
+        if (opos % 4 != 0) opos++;  // keep aligned
+        if (opos % 4 != 0) opos++;  // keep aligned
+        if (opos % 4 != 0) opos++;  // keep aligned
+        if (opos % 4 != 0) opos++;  // keep aligned
+
+        // read stream sizes
+        ipos[0] = opos + (nstreams - 1) * 4;
+        for (int stream = 0; stream + 1 < nstreams; stream++) {
+            uint32_t size = GetUInt32(ibuf + opos + stream * 4);
+            if (size > uint32_t(ilen - ipos[stream])) {  // corrupted: stream beyond the block
+                return -1;
+            }
+            iend[stream] = ipos[stream] + size;
+            ipos[stream + 1] = iend[stream];
+        }
+        iend[nstreams - 1] = ilen;
+
+        if (!repeat) {
+            MakeDecodeTables(length_table1, length_table2, m_tables);
+            m_tables_valid = true;
+        }
+    }
+
+    // decode: one refill per token covers the longest (literal/length code + idx code + idx bits)
+    int i = 0;
+    int len[kHuffmanStreams];
+
+    if (nstreams == 1) {
+        while (i < rlen) {
+            if ((len[0] = DecodeToken(tables, &codebuf0, ibuf, &ipos[0], iend[0], tbuf + i)) < 0) {
+                return -1;
+            }
+            i += 1 + (tbuf[i] >= 256);
+            dlen += len[0];
+        }
+        return dlen;
+    }
+
+    // one token from each stream per iteration, the bit buffers are independent so their
+    //  lookups can run in parallel.
+    while (i < rlen) {
+        if ((len[0] = DecodeToken(tables, &codebuf0, ibuf, &ipos[0], iend[0], tbuf + i)) < 0) {
+            return -1;
+        }
+        i += 1 + (tbuf[i] >= 256);
+        dlen += len[0];
+        if (i >= rlen) {
+            break;
+        }
+        if ((len[1] = DecodeToken(tables, &codebuf1, ibuf, &ipos[1], iend[1], tbuf + i)) < 0) {
+            return -1;
+        }
+        i += 1 + (tbuf[i] >= 256);
+        dlen += len[1];
+        if (i >= rlen) {
+            break;
+        }
+        if ((len[2] = DecodeToken(tables, &codebuf2, ibuf, &ipos[2], iend[2], tbuf + i)) < 0) {
+            return -1;
+        }
+        i += 1 + (tbuf[i] >= 256);
+        dlen += len[2];
+        if (i >= rlen) {
+            break;
+        }
+        if ((len[3] = DecodeToken(tables, &codebuf3, ibuf, &ipos[3], iend[3], tbuf + i)) < 0) {
+            return -1;
+        }
+        i += 1 + (tbuf[i] >= 256);
+        dlen += len[3];
+    }
+    return dlen;
+}
+
+int ZlingWriteIndex(const std::vector<ZlingIndexEntry>& entries, unsigned char* obuf) {
+    int size = ZlingIndexSize(entries.size());
+    int opos = 0;
+
+    obuf[opos++] = kFlagIndex;
+    PutUInt32(obuf + opos, entries.size()), opos += 4;
+    for (size_t i = 0; i < entries.size(); i++) {
+        PutUInt32(obuf + opos, entries[i].size), opos += 4;
+        PutUInt32(obuf + opos, entries[i].dlen), opos += 4;
+    }
+    PutUInt32(obuf + opos, size), opos += 4;
+    PutUInt32(obuf + opos, kIndexMagic), opos += 4;
+    return opos;
+}
+
+int ZlingReadIndexSize(const unsigned char* trailer) {
+    uint32_t size = GetUInt32(trailer);
+
+    if (GetUInt32(trailer + 4) != kIndexMagic || size > uint32_t(ZlingIndexSize(kIndexMaxRounds))) {
+        return -1;
+    }
+    return size;
+}
+
+int ZlingReadIndex(const unsigned char* buf, int len, std::vector<ZlingIndexEntry>* entries, int window) {
+    if (len < ZlingIndexSize(0) || buf[0] != kFlagIndex) {
+        return -1;
+    }
+    uint32_t nrounds = GetUInt32(buf + 1);
+    if (nrounds > uint32_t(kIndexMaxRounds) || len != ZlingIndexSize(nrounds)) {
+        return -1;
+    }
+    entries->resize(nrounds);
+    for (uint32_t i = 0; i < nrounds; i++) {
+        (*entries)[i].size = GetUInt32(buf + kIndexHeaderSize + i * 8);
+        (*entries)[i].dlen = GetUInt32(buf + kIndexHeaderSize + i * 8 + 4);
+        if ((*entries)[i].size > uint32_t(kRoundHeaderSize + ZlingRoundOutSize(window))
+                || (*entries)[i].dlen > uint32_t(window)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int ZlingWriteWindow(int window, unsigned char* obuf) {
+    obuf[0] = kFlagWindow;
+    PutUInt32(obuf + 1, window);
+    return kWindowHeaderSize;
+}
+
+int ZlingReadWindow(const unsigned char* buf, int len) {
+    if (len < 1 || buf[0] != kFlagWindow) {
+        return kBlockSizeIn;
+    }
+    if (len < kWindowHeaderSize) {
+        return -1;
+    }
+    uint32_t window = GetUInt32(buf + 1);
+    if (window < uint32_t(kBlockSizeIn) || window > uint32_t(kWindowSizeMax)) {
+        return -1;
+    }
+    return window;
+}
+
+int ZlingParseRound(const unsigned char* buf, int len, bool eof, int* need, int* hlen, int* dlen, int window) {
+    if (len < 1) {
+        *need = 1;
+        return eof ? -1 : 0;
+    }
+
+    if (buf[0] == kFlagRoundSized) {
+        if (len < kRoundHeaderSize) {
+            *need = kRoundHeaderSize;
+            return eof ? -1 : 0;
+        }
+        uint32_t blen = GetUInt32(buf + 1);
+        uint32_t size = GetUInt32(buf + 5);
+        if (blen > uint32_t(ZlingRoundOutSize(window)) || size > uint32_t(window)) {
+            return -1;
+        }
+        if (uint32_t(len - kRoundHeaderSize) < blen) {
+            *need = kRoundHeaderSize + blen;
+            return eof ? -1 : 0;
+        }
+        *hlen = kRoundHeaderSize;
+        *dlen = size;
+        return kRoundHeaderSize + blen;
+    }
+
+    if (buf[0] == kFlagRoundStart) {  // legacy round: walk through rolz blocks
+        int pos = 1;
+
+        while (pos < len && buf[pos] == kFlagRoundBlock) {
+            if (len - pos < kBlockHeaderSize) {
+                *need = pos + kBlockHeaderSize;
+                return eof ? -1 : 0;
+            }
+            const unsigned char* header = buf + pos + 1;
+            uint32_t blen = header[1] * 16777216u + header[3] * 65536u + header[5] * 256u + header[7];
+            if (blen > uint32_t(kBlockSizeHuffman) || pos - 1 + kBlockHeaderSize + int(blen) > kBlockSizeOut) {
+                return -1;
+            }
+            if (len - pos - kBlockHeaderSize < int(blen)) {
+                *need = pos + kBlockHeaderSize + blen;
+                return eof ? -1 : 0;
+            }
+            pos += kBlockHeaderSize + blen;
+        }
+        if (pos == len && !eof) {  // round ends only when next flag is known
+            *need = pos + 1;
+            return 0;
+        }
+        *hlen = 1;
+        *dlen = -1;
+        return pos;
+    }
+
+    if (buf[0] == kFlagIndex) {  // index frame: nothing to decode
+        if (len < kIndexHeaderSize) {
+            *need = kIndexHeaderSize;
+            return eof ? -1 : 0;
+        }
+        uint32_t nrounds = GetUInt32(buf + 1);
+        if (nrounds > uint32_t(kIndexMaxRounds)) {
+            return -1;
+        }
+        int size = ZlingIndexSize(nrounds);
+        if (len < size) {
+            *need = size;
+            return eof ? -1 : 0;
+        }
+        *hlen = size;
+        *dlen = 0;
+        return size;
+    }
+
+    if (buf[0] == kFlagWindow) {  // window frame: nothing to decode, must fit the decoder's window
+        if (len < kWindowHeaderSize) {
+            *need = kWindowHeaderSize;
+            return eof ? -1 : 0;
+        }
+        if (GetUInt32(buf + 1) > uint32_t(window)) {
+            return -1;
+        }
+        *hlen = kWindowHeaderSize;
+        *dlen = 0;
+        return kWindowHeaderSize;
+    }
+    return -1;
+}
+
+}  // namespace codec
+}  // namespace zling
+}  // namespace baidu
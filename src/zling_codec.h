@@ -0,0 +1,364 @@
+/**
+ * zling:
+ *  light-weight lossless data compression utility.
+ *
+ * Copyright (C) 2012-2013 by Zhang Li <zhangli10 at baidu.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * @author zhangli10<zhangli10@baidu.com>
+ * @brief  encode/decode rolz rounds (rolz + huffman stages).
+ */
+#ifndef SRC_ZLING_CODEC_H
+#define SRC_ZLING_CODEC_H
+
+#if HAS_CXX11_SUPPORT
+#include <cstdint>
+#else
+#include <stdint.h>
+#include <inttypes.h>
+#endif
+
+#include <vector>
+
+#include "src/zling_lz.h"
+
+namespace baidu {
+namespace zling {
+namespace codec {
+
+static const int kBlockSizeIn      = 16777216;  // round size (default window)
+static const int kBlockSizeRolz    = 262144;
+static const int kBlockSizeHuffman = 393216;
+
+// stream flags:
+//  a round starts with kFlagRoundStart (legacy) or kFlagRoundSized, followed by rolz blocks,
+//  each starting with kFlagRoundBlock and an 8-byte rlen/olen header.
+//  a round encoded with a dictionary starts with kFlagRoundDict, the 4-byte dictionary id and the
+//  4-byte dictionary size, matches of the round may then refer to the dictionary.
+//  kFlagRoundBlockInterleaved blocks have the same header, their huffman codes are split into 4
+//  interleaved streams (sizes of the first 3 stored after the length tables) to decode in parallel.
+//  kFlagRoundBlockStatic blocks have the same header, their huffman codes use the built-in static
+//  tables, so no length table is stored (one stream), the encoder selects them for small blocks.
+//  kFlagRoundBlockRepeat blocks are interleaved blocks without length tables, they reuse the tables
+//  of the last block of the round that stored them.
+//  kFlagRoundBlockStored blocks have the same header (rlen == olen), followed by the raw bytes,
+//  which are not added to rolz buckets, the encoder selects them for incompressible data.
+//  a round with checksum starts with kFlagRoundChecksum and the 4-byte crc32c of the decoded round
+//  (before kFlagRoundDict, if any), it is verified once the whole round is decoded.
+//  kFlagRoundSized is followed by the 4-byte size of round body (rolz blocks) and the 4-byte
+//  size of decoded round, so a decoder can read a whole round without parsing.
+//
+//  a stream encoded with a large window (rounds larger than kBlockSizeIn) starts with a window
+//  frame: kFlagWindow and the 4-byte max decoded round size, so a decoder can size its buffers.
+//
+//  a seekable stream ends with an index frame: kFlagIndex, 4-byte round count, 4-byte round size
+//  and 4-byte decoded size per round, then a trailer (4-byte index frame size and kIndexMagic),
+//  so it can be located from the end of stream.
+static const int kFlagRoundStart = 0;
+static const int kFlagRoundBlock = 1;
+static const int kFlagRoundSized = 2;
+static const int kFlagIndex      = 3;
+static const int kFlagRoundBlockInterleaved = 4;
+static const int kFlagRoundDict = 5;
+static const int kFlagRoundBlockStatic = 6;
+static const int kFlagRoundBlockRepeat = 7;
+static const int kFlagRoundChecksum = 8;
+static const int kFlagRoundBlockStored = 9;
+static const int kFlagWindow = 10;
+
+static const int kRoundHeaderSize = 9;
+static const int kBlockHeaderSize = 9;
+static const int kChecksumHeaderSize = 5;
+static const int kWindowHeaderSize = 5;
+static const int kIndexHeaderSize = 5;
+static const int kIndexTrailerSize = 8;
+static const uint32_t kIndexMagic = 0x7a6c6978;  // "zlix"
+
+// max size of an encoded round: round header + (block header + huffman block) per rolz block.
+static const int kBlockSizeOut =
+    kRoundHeaderSize + (kBlockSizeIn / kBlockSizeRolz + 1) * (kBlockHeaderSize + kBlockSizeHuffman);
+
+// large window: rounds up to kWindowSizeMax bytes (rolz positions are 32-bit), fewer rounds mean
+//  fewer bucket resets and matches across what would be round boundaries, at the cost of memory.
+static const int kWindowSizeMax = 268435456;
+
+// ZlingRoundOutSize: max size of an encoded round of ilen bytes, same as kBlockSizeOut for kBlockSizeIn.
+static inline int ZlingRoundOutSize(int ilen) {
+    return kRoundHeaderSize + (ilen / kBlockSizeRolz + 1) * (kBlockHeaderSize + kBlockSizeHuffman);
+}
+
+struct ZlingEncodeTables;
+struct ZlingEncodeJob;
+struct ZlingDecodeJob;
+struct ZlingDecodeTables;
+
+// ZlingStageTimes: wall time (seconds) spent in each stage, accumulated until reset.
+struct ZlingStageTimes {
+    double rolz;
+    double huffman;
+};
+
+// ZlingBlockStats: statistics of an encoded rolz block (ZLING_STATS=1 builds).
+struct ZlingBlockStats {
+    int      flag;          // block type
+    int      ilen;          // input data length
+    int      olen;          // encoded length (without block header)
+    int      symbols;       // rolz symbols (literals, match lengths and indices)
+    int      literals;
+    int      matches;
+    uint64_t match_bytes;   // data length covered by matches
+    uint64_t table_bits;    // length table and stream sizes
+    uint64_t payload_bits;  // huffman codes and extra bits
+    lz::ZlingRolzStats rolz;  // match finder counters of the block
+    ZlingStageTimes times;
+};
+
+// ZlingRoundEncoder: encode a whole round (up to kBlockSizeIn bytes, or kWindowSizeMax) into memory.
+//  rounds are independent, so each encoder can run in its own thread.
+class ZlingRoundEncoder {
+public:
+    ZlingRoundEncoder();
+    ~ZlingRoundEncoder();
+
+    /* Encode:
+     *  arg ibuf:   input data
+     *  arg ilen:   input data length (<= kWindowSizeMax)
+     *  arg obuf:   output data (flags, block headers and huffman blocks)
+     *              should have at least ZlingRoundOutSize(ilen) bytes
+     *  return:     output data length
+     */
+    int Encode(const unsigned char* ibuf, int ilen, unsigned char* obuf);
+
+    // SetLevel: set compression level (lz::kMinLevel .. lz::kMaxLevel).
+    void SetLevel(int level);
+
+    // SetChecksum: store crc32c of each round, computed block by block while encoding.
+    void SetChecksum(bool checksum) {
+        m_checksum = checksum;
+        return;
+    }
+
+    // SetPipeline: huffman-code each block in a second thread while rolz encodes the next one,
+    //  for rounds of more than one block. output is the same as without it.
+    void SetPipeline(bool pipeline) {
+        m_pipeline = pipeline;
+        return;
+    }
+
+    /* SetDictionary: prime each round with dict (copied), rounds longer than
+     *  kBlockSizeIn - len are encoded without it.
+     *  arg dict:   dictionary, NULL to remove
+     *  arg len:    dictionary size (<= dict::kDictMaxSize)
+     *  return:     0, -1 if len is invalid
+     */
+    int SetDictionary(const unsigned char* dict, int len);
+
+    // GetStageTimes/ResetStageTimes: time spent in rolz and huffman encoding.
+    const ZlingStageTimes& GetStageTimes() const {
+        return m_times;
+    }
+    void ResetStageTimes() {
+        m_times.rolz = 0;
+        m_times.huffman = 0;
+        return;
+    }
+
+    // GetBlockStats: stats of each block of the last encoded round, empty unless built with ZLING_STATS=1.
+    const std::vector<ZlingBlockStats>& GetBlockStats() const {
+        return m_block_stats;
+    }
+
+private:
+    int EncodeBlock(const ZlingEncodeJob& job, const unsigned char* ibuf, unsigned char* obuf);
+    int EncodeHuffman(const uint16_t* tbuf, int rlen, unsigned char* obuf, int* flag);
+    static void* PipelineThread(void* arg);
+#if ZLING_STATS
+    ZlingBlockStats MakeBlockStats(
+        int flag, int ilen, int olen, const uint16_t* tbuf, int rlen, const lz::ZlingRolzStats& rolz);
+#endif
+
+    lz::ZlingRolzEncoder* m_lzencoder;
+    uint16_t* m_tbuf;
+    uint16_t* m_ring;  // token buffers of the pipeline, allocated on first use
+    bool m_pipeline;
+    ZlingEncodeTables* m_tables;  // tables of the last block that stored them
+    bool m_tables_valid;
+
+    unsigned char* m_dbuf;  // dictionary followed by data of current round
+    int m_dbufsize;
+    int m_dictlen;
+    uint32_t m_dictid;
+    bool m_checksum;
+    ZlingStageTimes m_times;
+    std::vector<ZlingBlockStats> m_block_stats;
+
+    ZlingRoundEncoder(const ZlingRoundEncoder&);
+    ZlingRoundEncoder& operator = (const ZlingRoundEncoder&);
+};
+
+/* ZlingDecodeSink: receives decoded data block by block, in order.
+ *  arg buf:    decoded data of a block, final once passed (later blocks only read it)
+ *  arg len:    decoded data length
+ *  arg arg:    argument given to SetSink()
+ */
+typedef void (*ZlingDecodeSink)(const unsigned char* buf, int len, void* arg);
+
+// ZlingRoundDecoder: decode rolz blocks of a round into memory.
+class ZlingRoundDecoder {
+public:
+    ZlingRoundDecoder();
+    ~ZlingRoundDecoder();
+
+    /* Decode:
+     *  arg ibuf:   input data (round body, readable up to ibuf[ilen + 15])
+     *  arg ilen:   input data length (<= ZlingRoundOutSize(olen))
+     *  arg obuf:   output data
+     *  arg olen:   output data capacity (<= kWindowSizeMax), nothing is written beyond obuf[olen - 1]
+     *  arg stop:   stop decoding once obuf[0 .. stop - 1] is decoded (for range decoding)
+     *  return:     output data length, -1 on corrupted round (or checksum mismatch)
+     */
+    int  Decode(const unsigned char* ibuf, int ilen, unsigned char* obuf, int olen, int stop = kWindowSizeMax);
+    void Reset();
+
+    // SetSink: pass decoded data to sink as soon as each block is decoded, NULL to remove.
+    //  rounds with a checksum are passed at once after it is verified, nothing of a mismatching one.
+    //  data of a round later found corrupted otherwise (or beyond stop) is passed too, Decode() tells.
+    void SetSink(ZlingDecodeSink sink, void* arg) {
+        m_sink = sink;
+        m_sink_arg = arg;
+        return;
+    }
+
+    // SetDictionary: dictionary for rounds encoded with one, see ZlingRoundEncoder::SetDictionary().
+    int SetDictionary(const unsigned char* dict, int len);
+
+    // SetPipeline: huffman-decode the next block in a second thread while rolz decodes the current one,
+    //  for rounds of more than one block. output is the same as without it.
+    void SetPipeline(bool pipeline) {
+        m_pipeline = pipeline;
+        return;
+    }
+
+    // GetStageTimes/ResetStageTimes: time spent in huffman and rolz decoding.
+    const ZlingStageTimes& GetStageTimes() const {
+        return m_times;
+    }
+    void ResetStageTimes() {
+        m_times.rolz = 0;
+        m_times.huffman = 0;
+        return;
+    }
+
+private:
+    int DecodeBlocks(const unsigned char* ibuf, int ilen, unsigned char* obuf, int olen, int stop, int* decpos);
+    int DecodeBlockHuffman(const unsigned char* ibuf, int ilen, int* ipos, int olen, int decpos, ZlingDecodeJob* job);
+    void DecodeBlockRolz(const ZlingDecodeJob& job, unsigned char* obuf, int olen, int* decpos);
+    int DecodeHuffman(const unsigned char* ibuf, int ilen, int rlen, int flag, uint16_t* tbuf);
+    static void* PipelineThread(void* arg);
+
+    lz::ZlingRolzDecoder* m_lzdecoder;
+    uint16_t* m_tbuf;
+    uint16_t* m_ring;  // token buffers of the pipeline, allocated on first use
+    bool m_pipeline;
+    ZlingDecodeTables* m_tables;  // tables of the last block that stored them
+    bool m_tables_valid;
+
+    unsigned char* m_dbuf;  // dictionary followed by data of current round
+    int m_dbufsize;
+    int m_dictlen;
+    uint32_t m_dictid;
+    bool m_checksum;  // current round has checksum, m_crc of decoded data
+    uint32_t m_crc;
+    ZlingDecodeSink m_sink;
+    void* m_sink_arg;
+    ZlingStageTimes m_times;
+
+    ZlingRoundDecoder(const ZlingRoundDecoder&);
+    ZlingRoundDecoder& operator = (const ZlingRoundDecoder&);
+};
+
+struct ZlingIndexEntry {
+    uint32_t size;  // round size (header + body)
+    uint32_t dlen;  // decoded round size
+};
+
+static inline int ZlingIndexSize(int nrounds) {
+    return kIndexHeaderSize + nrounds * 8 + kIndexTrailerSize;
+}
+
+// max rounds in an index, keeps the index frame within one staged round.
+static const int kIndexMaxRounds = (kBlockSizeOut - 16) / 8;
+
+/* ZlingWriteIndex: write index frame.
+ *  arg obuf:   output data, should have at least ZlingIndexSize(entries.size()) bytes
+ *  return:     output data length
+ */
+int ZlingWriteIndex(const std::vector<ZlingIndexEntry>& entries, unsigned char* obuf);
+
+/* ZlingReadIndexSize: get index frame size from the last kIndexTrailerSize bytes of stream.
+ *  return:     index frame size, -1 if the stream is not seekable
+ */
+int ZlingReadIndexSize(const unsigned char* trailer);
+
+/* ZlingReadIndex: read index frame.
+ *  arg window: max decoded round size of the stream
+ *  return:     0 on success, -1 if corrupted
+ */
+int ZlingReadIndex(const unsigned char* buf, int len, std::vector<ZlingIndexEntry>* entries, int window = kBlockSizeIn);
+
+/* ZlingWriteWindow: write window frame (for window > kBlockSizeIn only).
+ *  arg obuf:   output data, should have at least kWindowHeaderSize bytes
+ *  return:     output data length
+ */
+int ZlingWriteWindow(int window, unsigned char* obuf);
+
+/* ZlingReadWindow: read window frame at the start of stream.
+ *  arg buf:    stream data, at least kWindowHeaderSize bytes if available
+ *  arg len:    stream data length
+ *  return:     window of the stream (kBlockSizeIn without window frame), -1 if corrupted
+ *              the frame is left to ZlingParseRound(), which skips it
+ */
+int ZlingReadWindow(const unsigned char* buf, int len);
+
+/* ZlingParseRound: find a complete round in buffered stream data.
+ *  arg buf:    stream data, starting with a round flag
+ *  arg len:    stream data length
+ *  arg eof:    no more data follows buf[len - 1]
+ *  arg need:   set to the data length needed to continue if the round is incomplete
+ *  arg hlen:   set to the round header length (round body starts at buf[hlen])
+ *  arg dlen:   set to the decoded round size, -1 if unknown (legacy round)
+ *  arg window: max decoded round size, larger rounds (or window frames) are corrupted
+ *  return:     size of the round (header + body), 0 if incomplete, -1 if corrupted
+ *              index/window frames are returned as rounds with empty body (*hlen = size, *dlen = 0)
+ */
+int ZlingParseRound(
+    const unsigned char* buf, int len, bool eof, int* need, int* hlen, int* dlen, int window = kBlockSizeIn);
+
+}  // namespace codec
+}  // namespace zling
+}  // namespace baidu
+#endif  // SRC_ZLING_CODEC_H
@@ -0,0 +1,156 @@
+/**
+ * zling:
+ *  light-weight lossless data compression utility.
+ *
+ * Copyright (C) 2012-2013 by Zhang Li <zhangli10 at baidu.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * @author zhangli10<zhangli10@baidu.com>
+ * @brief  build dictionaries for priming rolz rounds of small records.
+ */
+#include <algorithm>
+#include <cstring>
+#include <queue>
+#include <vector>
+
+#include "src/zling_dict.h"
+
+namespace baidu {
+namespace zling {
+namespace dict {
+
+static const int kTrainKmerLen = 8;        // segments are scored by the k-mers they contain
+static const int kTrainSegmentLen = 64;
+static const int kTrainHashBits = 20;
+
+struct ZlingSegment {
+    int pos;
+    int len;
+    uint64_t score;
+
+    bool operator < (const ZlingSegment& other) const {
+        return score < other.score;
+    }
+};
+
+static inline uint32_t HashKmer(const unsigned char* ptr) {
+    uint64_t x;
+    memcpy(&x, ptr, sizeof(x));
+    return (x * 0x9e3779b97f4a7c15ull) >> (64 - kTrainHashBits);
+}
+
+uint32_t ZlingDictionaryId(const unsigned char* dict, int len) {
+    uint32_t id = 2166136261u;  // FNV-1a
+
+    for (int i = 0; i < len; i++) {
+        id = (id ^ dict[i]) * 16777619u;
+    }
+    return id;
+}
+
+int ZlingTrainDictionary(const unsigned char* samples,
+                         const int* sizes,
+                         int nsamples,
+                         unsigned char* dict,
+                         int dictcap) {
+    std::vector<uint32_t> frequency(1 << kTrainHashBits, 0);   // number of samples containing a k-mer
+    std::vector<int32_t>  last_sample(1 << kTrainHashBits, -1);
+    std::vector<bool>     covered(1 << kTrainHashBits, false);
+    std::vector<ZlingSegment> segments;
+    std::vector<ZlingSegment> selected;
+    int pos = 0;
+    int dictlen = 0;
+
+    dictcap = std::min(dictcap, kDictMaxSize);
+
+    // count k-mers once per sample, a k-mer seen in one sample only does not help other records
+    for (int i = 0; i < nsamples; pos += sizes[i++]) {
+        for (int j = 0; j + kTrainKmerLen <= sizes[i]; j++) {
+            uint32_t hash = HashKmer(samples + pos + j);
+            if (last_sample[hash] != i) {
+                last_sample[hash] = i;
+                frequency[hash] += 1;
+            }
+        }
+    }
+
+    // score segments
+    pos = 0;
+    for (int i = 0; i < nsamples; pos += sizes[i++]) {
+        for (int j = 0; j + kTrainKmerLen <= sizes[i]; j += kTrainSegmentLen) {
+            ZlingSegment segment = {pos + j, std::min(kTrainSegmentLen, sizes[i] - j), 0};
+
+            for (int k = 0; k + kTrainKmerLen <= segment.len; k++) {
+                segment.score += frequency[HashKmer(samples + segment.pos + k)] - 1;
+            }
+            if (segment.score > 0) {
+                segments.push_back(segment);
+            }
+        }
+    }
+
+    // lazy greedy selection: a segment's score only drops as k-mers get covered, so the best
+    //  segment is taken once its rescored value still beats all others.
+    std::priority_queue<ZlingSegment> queue(segments.begin(), segments.end());
+
+    while (!queue.empty() && dictlen < dictcap) {
+        ZlingSegment segment = queue.top();
+        uint64_t score = 0;
+
+        queue.pop();
+        for (int k = 0; k + kTrainKmerLen <= segment.len; k++) {
+            uint32_t hash = HashKmer(samples + segment.pos + k);
+            score += covered[hash] ? 0 : frequency[hash] - 1;
+        }
+        if (score == 0) {
+            continue;
+        }
+        if (score < segment.score && !queue.empty() && score < queue.top().score) {
+            segment.score = score;
+            queue.push(segment);
+            continue;
+        }
+        for (int k = 0; k + kTrainKmerLen <= segment.len; k++) {
+            covered[HashKmer(samples + segment.pos + k)] = true;
+        }
+        segment.len = std::min(segment.len, dictcap - dictlen);
+        selected.push_back(segment);
+        dictlen += segment.len;
+    }
+
+    // best segments last: they are closest to the data and get the smallest match indexes
+    pos = 0;
+    for (size_t i = selected.size(); i > 0; i--) {
+        memcpy(dict + pos, samples + selected[i - 1].pos, selected[i - 1].len);
+        pos += selected[i - 1].len;
+    }
+    return dictlen;
+}
+
+}  // namespace dict
+}  // namespace zling
+}  // namespace baidu
@@ -0,0 +1,73 @@
+/**
+ * zling:
+ *  light-weight lossless data compression utility.
+ *
+ * Copyright (C) 2012-2013 by Zhang Li <zhangli10 at baidu.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * @author zhangli10<zhangli10@baidu.com>
+ * @brief  build dictionaries for priming rolz rounds of small records.
+ */
+#ifndef SRC_ZLING_DICT_H
+#define SRC_ZLING_DICT_H
+
+#if HAS_CXX11_SUPPORT
+#include <cstdint>
+#else
+#include <stdint.h>
+#include <inttypes.h>
+#endif
+
+namespace baidu {
+namespace zling {
+namespace dict {
+
+static const int kDictMaxSize = 1048576;
+static const int kDictDefaultSize = 65536;
+
+// ZlingDictionaryId: identify a dictionary in the stream, so a round is never decoded with a
+//  different dictionary than it was encoded with.
+uint32_t ZlingDictionaryId(const unsigned char* dict, int len);
+
+/* ZlingTrainDictionary: pick segments shared by many samples into a dictionary.
+ *  arg samples:  all samples, concatenated
+ *  arg sizes:    size of each sample
+ *  arg nsamples: number of samples
+ *  arg dict:     output dictionary
+ *  arg dictcap:  max dictionary size (<= kDictMaxSize)
+ *  return:       dictionary size, most useful segments are placed at the end
+ */
+int ZlingTrainDictionary(const unsigned char* samples,
+                         const int* sizes,
+                         int nsamples,
+                         unsigned char* dict,
+                         int dictcap);
+
+}  // namespace dict
+}  // namespace zling
+}  // namespace baidu
+#endif  // SRC_ZLING_DICT_H
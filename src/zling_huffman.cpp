@@ -179,6 +179,26 @@ void ZlingMakeDecodeTable(
     return;
 }
 
+void ZlingMakePackedDecodeTable(
+    const uint32_t* length_table,
+    uint16_t* encode_table,
+    uint16_t* decode_table,
+    int max_codes,
+    int max_codelen) {
+
+    memset(decode_table, -1, sizeof(decode_table[0]) * (1 << max_codelen));
+
+    for (int c = 0; c < max_codes; c++) {
+        if (length_table[c] > 0 && length_table[c] <= uint16_t(max_codelen)) {
+            uint16_t entry = length_table[c] << kPackedLenShift | c;
+            for (int i = encode_table[c]; i < (1 << max_codelen); i += (1 << length_table[c])) {
+                decode_table[i] = entry;
+            }
+        }
+    }
+    return;
+}
+
 }  // namespace huffman
 }  // namespace zling
 }  // namespace baidu
@@ -76,6 +76,17 @@ void ZlingMakeDecodeTable(const uint32_t* length_table,
                           int max_codes,
                           int max_codelen);
 
+// ZlingMakePackedDecodeTable: build decode table from canonical length table,
+//  each entry packs (code length << kPackedLenShift | symbol), invalid codes are kPackedInvalid.
+static const int      kPackedLenShift = 12;
+static const uint16_t kPackedInvalid = 0xffff;
+
+void ZlingMakePackedDecodeTable(const uint32_t* length_table,
+                                uint16_t* encode_table,
+                                uint16_t* decode_table,
+                                int max_codes,
+                                int max_codelen);
+
 }  // namespace huffman
 }  // namespace zling
 }  // namespace baidu
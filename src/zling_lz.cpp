@@ -32,13 +32,30 @@
  * @author zhangli10<zhangli10@baidu.com>
  * @brief  manipulate ROLZ (reduced offset Lempel-Ziv) compression.
  */
+#include <algorithm>
+
 #include "src/zling_lz.h"
 
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define ZLING_HAS_WORD_COMPARE 1
+#endif
+
+#if defined(__GNUC__)
+#define ZLING_PREFETCH(ptr) __builtin_prefetch(ptr)
+#else
+#define ZLING_PREFETCH(ptr) ((void) 0)
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__)  // AVX2 picked at runtime by cpu feature
+#define ZLING_HAS_AVX2_COMPARE 1
+#include <immintrin.h>
+#endif
+
 namespace baidu {
 namespace zling {
 namespace lz {
 
-static inline uint32_t HashContext(unsigned char* ptr) {
+static inline uint32_t HashContext(const unsigned char* ptr) {
     return (ptr[0] * 33337 + ptr[1] * 3337 + ptr[2] * 337 + ptr[3]);
 }
 
@@ -49,9 +66,11 @@ static inline uint32_t RollingSub(uint32_t x, uint32_t y) {
     return (x - y) & (kBucketItemSize - 1);
 }
 
-static inline int GetCommonLength(unsigned char* buf1, unsigned char* buf2, int maxlen) {
-    unsigned char* p1 = buf1;
-    unsigned char* p2 = buf2;
+// GetCommonLength: compare up to maxlen bytes, callers guarantee both buffers hold maxlen readable bytes.
+//  the wide versions compare a word/vector at a time and locate the first mismatch with ctz.
+static inline int GetCommonLengthBytewise(const unsigned char* buf1, const unsigned char* buf2, int maxlen) {
+    const unsigned char* p1 = buf1;
+    const unsigned char* p2 = buf2;
 
     while ((maxlen--) > 0 && *p1 == *p2) {
         p1++;
@@ -60,14 +79,78 @@ static inline int GetCommonLength(unsigned char* buf1, unsigned char* buf2, int
     return p1 - buf1;
 }
 
+#if ZLING_HAS_WORD_COMPARE
+static inline int GetCommonLengthWord(const unsigned char* buf1, const unsigned char* buf2, int maxlen) {
+    int len = 0;
+
+    while (len + 8 <= maxlen) {
+        uint64_t word1;
+        uint64_t word2;
+        memcpy(&word1, buf1 + len, 8);
+        memcpy(&word2, buf2 + len, 8);
+
+        if (word1 != word2) {
+            return len + __builtin_ctzll(word1 ^ word2) / 8;
+        }
+        len += 8;
+    }
+    return len + GetCommonLengthBytewise(buf1 + len, buf2 + len, maxlen - len);
+}
+#endif
+
+#if ZLING_HAS_AVX2_COMPARE
+__attribute__((target("avx2")))
+static int GetCommonLengthAVX2(const unsigned char* buf1, const unsigned char* buf2, int maxlen) {
+    int len = 0;
+
+    while (len + 32 <= maxlen) {
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf1 + len));
+        __m256i v2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf2 + len));
+        uint32_t mask = ~uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, v2)));
+
+        if (mask != 0) {
+            return len + __builtin_ctz(mask);
+        }
+        len += 32;
+    }
+    return len + GetCommonLengthWord(buf1 + len, buf2 + len, maxlen - len);
+}
+
+static bool DetectAVX2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+static const bool kHasAVX2 = DetectAVX2();
+#endif
+
+static inline int GetCommonLength(const unsigned char* buf1, const unsigned char* buf2, int maxlen) {
+#if ZLING_HAS_AVX2_COMPARE
+    if (kHasAVX2) {
+        return GetCommonLengthAVX2(buf1, buf2, maxlen);
+    }
+#endif
+#if ZLING_HAS_WORD_COMPARE
+    return GetCommonLengthWord(buf1, buf2, maxlen);
+#else
+    return GetCommonLengthBytewise(buf1, buf2, maxlen);
+#endif
+}
+
+static inline void Copy8(unsigned char* dst, const unsigned char* src) {
+    uint64_t word;  // memcpy() keeps unaligned and overlapped access well-defined
+    memcpy(&word, src, 8);
+    memcpy(dst, &word, 8);
+    return;
+}
+
 static inline void IncrementalCopyFastPath(unsigned char* src, unsigned char* dst, int len) {
     while (dst - src < 8) {
-        *reinterpret_cast<uint64_t*>(dst) = *reinterpret_cast<uint64_t*>(src);
+        Copy8(dst, src);
         len -= dst - src;
         dst += dst - src;
     }
     while (len > 0) {
-        *reinterpret_cast<uint64_t*>(dst) = *reinterpret_cast<uint64_t*>(src);
+        Copy8(dst, src);
         len -= 8;
         dst += 8;
         src += 8;
@@ -75,7 +158,31 @@ static inline void IncrementalCopyFastPath(unsigned char* src, unsigned char* ds
     return;
 }
 
-int ZlingRolzEncoder::Encode(unsigned char* ibuf, uint16_t* obuf, int ilen, int olen, int* encpos) {
+static inline void IncrementalCopySlowPath(unsigned char* src, unsigned char* dst, int len) {
+    while (len-- > 0) {
+        *dst++ = *src++;
+    }
+    return;
+}
+
+static const struct {
+    int  match_depth;
+    int  match_nice;
+    bool match_lazy;
+} kLevelParams[kMaxLevel + 1] = {
+    /* 0 */ {0,   0,            false},  // unused
+    /* 1 */ {1,   32,           false},
+    /* 2 */ {2,   48,           false},
+    /* 3 */ {4,   64,           false},
+    /* 4 */ {6,   128,          false},
+    /* 5 */ {8,   kMatchMaxLen, false},
+    /* 6 */ {16,  kMatchMaxLen, true},
+    /* 7 */ {32,  kMatchMaxLen, true},
+    /* 8 */ {64,  kMatchMaxLen, true},
+    /* 9 */ {256, kMatchMaxLen, true},
+};
+
+int ZlingRolzEncoder::Encode(const unsigned char* ibuf, uint16_t* obuf, int ilen, int olen, int* encpos) {
     int ipos = encpos[0];
     int opos = 0;
 
@@ -88,10 +195,30 @@ int ZlingRolzEncoder::Encode(unsigned char* ibuf, uint16_t* obuf, int ilen, int
         int match_idx;
         int match_len;
 
+        // next position is ipos + 1 or the end of a match: fetch its bucket while matching this one
+        Prefetch(ibuf, ipos + 1);
+
         if (Match(ibuf, ipos, &match_idx, &match_len)) {
+            if (ipos + match_len + kMatchMaxLen < ilen) {  // hashing reads 3 bytes past pos
+                Prefetch(ibuf, ipos + match_len);
+            }
+            Update(ibuf, ipos);
+
+            // lazy matching: prefer literal + longer match at next position
+            if (m_match_lazy && match_len < m_match_nice && opos + 2 < olen && ipos + 1 + kMatchMaxLen < ilen) {
+                int lazy_idx;
+                int lazy_len;
+
+                if (Match(ibuf, ipos + 1, &lazy_idx, &lazy_len) && lazy_len > match_len) {
+                    obuf[opos++] = ibuf[ipos];  // encode as literal
+                    ipos += 1;
+                    match_idx = lazy_idx;
+                    match_len = lazy_len;
+                    Update(ibuf, ipos);
+                }
+            }
             obuf[opos++] = 256 + match_len - kMatchMinLen;  // encode as match
             obuf[opos++] = match_idx;
-            Update(ibuf, ipos);
             ipos += match_len;
 
         } else {
@@ -104,19 +231,84 @@ int ZlingRolzEncoder::Encode(unsigned char* ibuf, uint16_t* obuf, int ilen, int
     // rest byte
     while (opos < olen && ipos < ilen) {
         obuf[opos++] = ibuf[ipos];
-        Update(ibuf, ipos);
+        if (ipos + kMatchMaxLen < ilen) {  // no more matching near the end, and avoid reading beyond ilen
+            Update(ibuf, ipos);
+        }
         ipos += 1;
     }
     encpos[0] = ipos;
     return opos;
 }
 
-void ZlingRolzEncoder::Reset() {
-    memset(m_buckets, 0, sizeof(m_buckets));
+// node in a hash entry takes 12 bits (kBucketItemSize == 4096), generation takes the other 4.
+static const int kHashNodeBits = 12;
+static const int kHashGenerations = 16;
+
+void ZlingRolzEncoder::Reset(bool with_dictionary) {
+    m_dict_active = with_dictionary && m_dict_buckets != NULL;
+    if (++m_epoch == 0) {  // epoch wrapped: stale buckets may look current, clear all
+        memset(m_buckets, 0, sizeof(m_buckets));
+    }
     return;
 }
 
-int ZlingRolzEncoder::Match(unsigned char* buf, int pos, int* match_idx, int* match_len) {
+inline ZlingRolzEncoder::ZlingEncodeBucket* ZlingRolzEncoder::GetBucket(int context) {
+    ZlingEncodeBucket* bucket = &m_buckets[context];
+
+    if (bucket->epoch != m_epoch) {
+        // only node 0 and hash entries can be reached before written, see Match()
+        bucket->epoch = m_epoch;
+        bucket->head = 0;
+        bucket->count = 0;
+        bucket->suffix[0] = 0;
+        bucket->offset[0] = 0;
+        bucket->check[0] = 0;
+        bucket->generation = (bucket->generation + 1) % kHashGenerations;
+        if (bucket->generation == 0) {
+            memset(bucket->hash, 0, sizeof(bucket->hash));
+        }
+    }
+    return bucket;
+}
+
+void ZlingRolzEncoder::SetDictionary(const unsigned char* dict, int len) {
+    if (len <= 0) {
+        delete [] m_dict_buckets;
+        m_dict_buckets = NULL;
+        return;
+    }
+    if (m_dict_buckets == NULL) {
+        m_dict_buckets = new ZlingEncodeBucket[256];
+    }
+    memset(m_dict_buckets, 0, sizeof(m_dict_buckets[0]) * 256);  // all in generation 0
+
+    // hashing reads 3 bytes beyond, which are round data when encoding: pad with zeros
+    unsigned char* buf = new unsigned char[len + 4];
+    memcpy(buf, dict, len);
+    memset(buf + len, 0, 4);
+    for (int pos = 1; pos < len; pos++) {
+        Insert(&m_dict_buckets[buf[pos - 1]], buf, pos);
+    }
+    delete [] buf;
+    return;
+}
+
+void ZlingRolzEncoder::SetLevel(int level) {
+    level = std::max(level, kMinLevel);
+    level = std::min(level, kMaxLevel);
+    m_match_depth = kLevelParams[level].match_depth;
+    m_match_nice  = kLevelParams[level].match_nice;
+    m_match_lazy  = kLevelParams[level].match_lazy;
+    return;
+}
+
+#if ZLING_STATS
+#define ZLING_STATS_ADD(counter, n) (m_stats.counter += (n))
+#else
+#define ZLING_STATS_ADD(counter, n) ((void) 0)
+#endif
+
+int ZlingRolzEncoder::Match(const unsigned char* buf, int pos, int* match_idx, int* match_len) {
     int maxlen = kMatchMinLen - 1;
     int maxidx = 0;
     int hash = HashContext(buf + pos);
@@ -124,52 +316,113 @@ int ZlingRolzEncoder::Match(unsigned char* buf, int pos, int* match_idx, int* ma
     int hash_context = hash % kBucketItemHash;
     int node;
     int i;
-    ZlingEncodeBucket* bucket = &m_buckets[buf[pos - 1]];
+    ZlingEncodeBucket* bucket = GetBucket(buf[pos - 1]);
 
+    // nodes are reached from hash entries of current generation or suffix links written in the
+    //  current epoch, any other node is node 0.
     node = bucket->hash[hash_context];
+    node = (node >> kHashNodeBits == bucket->generation) ? node % kBucketItemSize : 0;
+    ZLING_STATS_ADD(match_calls, 1);
 
-    for (i = 0; i < kMatchDepth; i++) {
-        int offset = bucket->offset[node] & 0xffffff;
-        int check = bucket->offset[node] >> 24;
+    for (i = 0; i < m_match_depth; i++) {
+        if (node == 0 && bucket->count < kBucketItemSize && m_dict_active) {
+            break;  // unwritten node 0 is the latest dictionary position, continue below
+        }
+        int offset = bucket->offset[node];
+        int check = bucket->check[node];
 
+        ZLING_STATS_ADD(chain_nodes, 1);
+        ZLING_STATS_ADD(check_rejects, check != hash_check);
         if (check == hash_check && buf[pos + maxlen] == buf[offset + maxlen]) {
             int len = GetCommonLength(buf + pos, buf + offset, kMatchMaxLen);
 
             if (len > maxlen) {
                 maxlen = len;
                 maxidx = RollingSub(bucket->head, node);
-                if (maxlen == kMatchMaxLen) {
+                if (maxlen >= m_match_nice) {
                     break;
                 }
             }
         }
-        if (offset <= int(bucket->offset[bucket->suffix[node]] & 0xffffff)) {
+        if (offset <= int(bucket->offset[bucket->suffix[node]])) {
             break;
         }
         node = bucket->suffix[node];
     }
+
+    // dictionary: its nodes come after the count nodes of this round in the bucket
+    if (m_dict_active && bucket->count < kBucketItemSize && maxlen < m_match_nice) {
+        ZlingEncodeBucket* dict_bucket = &m_dict_buckets[buf[pos - 1]];
+
+        node = dict_bucket->hash[hash_context];
+        node = (node >> kHashNodeBits == 0) ? node % kBucketItemSize : 0;
+
+        for (; i < m_match_depth; i++) {
+            int idx = bucket->count + RollingSub(dict_bucket->head, node);
+            if (idx >= kBucketItemSize || (node == 0 && dict_bucket->count < kBucketItemSize)) {
+                break;  // pushed out by this round, or unwritten
+            }
+            int offset = dict_bucket->offset[node];
+            int check = dict_bucket->check[node];
+
+            ZLING_STATS_ADD(chain_nodes, 1);
+            ZLING_STATS_ADD(check_rejects, check != hash_check);
+            if (check == hash_check && buf[pos + maxlen] == buf[offset + maxlen]) {
+                int len = GetCommonLength(buf + pos, buf + offset, kMatchMaxLen);
+
+                if (len > maxlen) {
+                    maxlen = len;
+                    maxidx = idx;
+                    if (maxlen >= m_match_nice) {
+                        break;
+                    }
+                }
+            }
+            if (offset <= int(dict_bucket->offset[dict_bucket->suffix[node]])) {
+                break;
+            }
+            node = dict_bucket->suffix[node];
+        }
+    }
     if (maxlen >= kMatchMinLen + (maxidx >= kMatchDiscardMinLen)) {
         *match_len = maxlen;
         *match_idx = maxidx;
         return 1;
     }
+    ZLING_STATS_ADD(discards, maxlen == kMatchMinLen);
     return 0;
 }
 
-void ZlingRolzEncoder::Update(unsigned char* buf, int pos) {
+void ZlingRolzEncoder::Update(const unsigned char* buf, int pos) {
+    Insert(GetBucket(buf[pos - 1]), buf, pos);
+    return;
+}
+
+// Prefetch: bucket header and hash entry read first by Match()/Insert() at pos.
+inline void ZlingRolzEncoder::Prefetch(const unsigned char* buf, int pos) {
+    ZlingEncodeBucket* bucket = &m_buckets[buf[pos - 1]];
+
+    ZLING_PREFETCH(bucket);
+    ZLING_PREFETCH(&bucket->hash[HashContext(buf + pos) % kBucketItemHash]);
+    return;
+}
+
+inline void ZlingRolzEncoder::Insert(ZlingEncodeBucket* bucket, const unsigned char* buf, int pos) {
     int hash = HashContext(buf + pos);
     int hash_check   = hash / kBucketItemHash % 256;
     int hash_context = hash % kBucketItemHash;
-    ZlingEncodeBucket* bucket = &m_buckets[buf[pos - 1]];
+    int node = bucket->hash[hash_context];
 
     bucket->head = RollingAdd(bucket->head, 1);
-    bucket->suffix[bucket->head] = bucket->hash[hash_context];
-    bucket->offset[bucket->head] = pos | hash_check << 24;
-    bucket->hash[hash_context] = bucket->head;
+    bucket->count += (bucket->count < kBucketItemSize);
+    bucket->suffix[bucket->head] = (node >> kHashNodeBits == bucket->generation) ? node % kBucketItemSize : 0;
+    bucket->offset[bucket->head] = pos;
+    bucket->check[bucket->head] = hash_check;
+    bucket->hash[hash_context] = bucket->head | bucket->generation << kHashNodeBits;
     return;
 }
 
-int ZlingRolzDecoder::Decode(uint16_t* ibuf, unsigned char* obuf, int ilen, int* decpos) {
+int ZlingRolzDecoder::Decode(uint16_t* ibuf, unsigned char* obuf, int ilen, int olen, int* decpos) {
     int opos = decpos[0];
     int ipos = 0;
     int match_idx;
@@ -194,7 +447,11 @@ int ZlingRolzDecoder::Decode(uint16_t* ibuf, unsigned char* obuf, int ilen, int*
             match_offset = GetMatch(obuf, opos, match_idx);
             Update(obuf, opos);
 
-            IncrementalCopyFastPath(&obuf[match_offset], &obuf[opos], match_len);
+            if (olen - opos - match_len >= 16) {
+                IncrementalCopyFastPath(&obuf[match_offset], &obuf[opos], match_len);
+            } else {  // near the end of obuf, fast path may overrun
+                IncrementalCopySlowPath(&obuf[match_offset], &obuf[opos], match_len);
+            }
             opos += match_len;
         }
     }
@@ -202,23 +459,80 @@ int ZlingRolzDecoder::Decode(uint16_t* ibuf, unsigned char* obuf, int ilen, int*
     return ipos;
 }
 
-void ZlingRolzDecoder::Reset() {
-    memset(m_buckets, 0, sizeof(m_buckets));
+void ZlingRolzDecoder::Reset(bool with_dictionary) {
+    m_dict_active = with_dictionary && m_dict_offset != NULL;
+    if (++m_epoch == 0) {  // epoch wrapped: stale buckets may look current, clear all
+        memset(m_buckets, 0, sizeof(m_buckets));
+    }
+    return;
+}
+
+inline ZlingRolzDecoder::ZlingDecodeBucket* ZlingRolzDecoder::GetBucket(int context) {
+    ZlingDecodeBucket* bucket = &m_buckets[context];
+
+    if (bucket->epoch != m_epoch) {
+        bucket->epoch = m_epoch;
+        bucket->head = 0;
+        bucket->count = 0;
+    }
+    return bucket;
+}
+
+void ZlingRolzDecoder::SetDictionary(const unsigned char* dict, int len) {
+    delete [] m_dict_offset;
+    m_dict_offset = NULL;
+    if (len <= 0) {
+        return;
+    }
+
+    // count positions per bucket (only the latest kBucketItemSize are reachable), then fill
+    int start = 0;
+    int count[256] = {0};
+
+    for (int pos = 1; pos < len; pos++) {
+        count[dict[pos - 1]] += 1;
+    }
+    for (int c = 0; c < 256; c++) {
+        m_dict_start[c] = start;
+        m_dict_count[c] = std::min(count[c], kBucketItemSize);
+        start += m_dict_count[c];
+    }
+    m_dict_offset = new uint32_t[start + 1];
+
+    memset(count, 0, sizeof(count));
+    for (int pos = len - 1; pos >= 1; pos--) {  // from the latest, skipping unreachable ones
+        int c = dict[pos - 1];
+        if (count[c] < m_dict_count[c]) {
+            count[c] += 1;
+            m_dict_offset[m_dict_start[c] + m_dict_count[c] - count[c]] = pos;
+        }
+    }
     return;
 }
 
 int ZlingRolzDecoder::GetMatch(unsigned char* buf, int pos, int idx) {
-    ZlingDecodeBucket* bucket = &m_buckets[buf[pos - 1]];
+    ZlingDecodeBucket* bucket = GetBucket(buf[pos - 1]);
     int head = bucket->head;
     int node = RollingSub(head, idx);
-    return bucket->offset[node];
+
+    // nodes head, head - 1, .. head - count + 1 are written, then dictionary positions (latest
+    //  first), others read as zero
+    if (idx < bucket->count) {
+        return bucket->offset[node];
+    }
+    if (m_dict_active && idx - bucket->count < m_dict_count[buf[pos - 1]]) {
+        int context = buf[pos - 1];
+        return m_dict_offset[m_dict_start[context] + m_dict_count[context] - 1 - (idx - bucket->count)];
+    }
+    return 0;
 }
 
 void ZlingRolzDecoder::Update(unsigned char* buf, int pos) {
-    ZlingDecodeBucket* bucket = &m_buckets[buf[pos - 1]];
+    ZlingDecodeBucket* bucket = GetBucket(buf[pos - 1]);
 
     bucket->head = RollingAdd(bucket->head, 1);
     bucket->offset[bucket->head] = pos;
+    bucket->count += (bucket->count < kBucketItemSize);
     return;
 }
 
@@ -44,6 +44,12 @@
 #include <inttypes.h>
 #endif
 
+// statistics (match finder counters, per-block stats in codec) are only collected when built with
+//  ZLING_STATS=1, otherwise they are compiled out.
+#ifndef ZLING_STATS
+#define ZLING_STATS 0
+#endif
+
 namespace baidu {
 namespace zling {
 namespace lz {
@@ -51,14 +57,42 @@ namespace lz {
 static const int kBucketItemSize = 4096;
 static const int kBucketItemHash = 8192;
 static const int kMatchDiscardMinLen = 3000;
-static const int kMatchDepth = 8;
 static const int kMatchMinLen = 4;
 static const int kMatchMaxLen = 259;
 
+// compression levels only change how hard the encoder searches for matches,
+//  the decoder is level-agnostic.
+static const int kMinLevel = 1;
+static const int kMaxLevel = 9;
+static const int kDefaultLevel = 5;
+
+// ZlingRolzStats: match finder counters (ZLING_STATS=1 builds).
+struct ZlingRolzStats {
+    uint64_t match_calls;    // Match() calls
+    uint64_t chain_nodes;    // bucket nodes visited
+    uint64_t check_rejects;  // nodes rejected by hash check
+    uint64_t discards;       // shortest matches discarded for a far index (kMatchDiscardMinLen)
+};
+
+// buckets are reset lazily: Reset() only starts a new epoch, a bucket from an older epoch is
+//  cleared when it is first touched. untouched entries still read as zero, so small inputs only
+//  pay for the buckets they use.
+//
+// a round with dictionary behaves as if dictionary positions 1 .. len - 1 were inserted into the
+//  buckets before encoding/decoding starts at position len. they are kept apart and built once,
+//  so using a dictionary costs nothing per round.
 class ZlingRolzEncoder {
 public:
     ZlingRolzEncoder() {
-        Reset();
+        memset(m_buckets, 0, sizeof(m_buckets));
+        m_epoch = 0;
+        m_dict_buckets = NULL;
+        m_dict_active = false;
+        memset(&m_stats, 0, sizeof(m_stats));
+        SetLevel(kDefaultLevel);
+    }
+    ~ZlingRolzEncoder() {
+        delete [] m_dict_buckets;
     }
 
     /* Encode:
@@ -68,20 +102,48 @@ public:
      *  arg olen:   input data length
      *  arg decpos: start encoding at ibuf[encpos], limited by ilen and olen
      */
-    int  Encode(unsigned char* ibuf, uint16_t* obuf, int ilen, int olen, int* encpos);
-    void Reset();
+    int  Encode(const unsigned char* ibuf, uint16_t* obuf, int ilen, int olen, int* encpos);
+    void SetLevel(int level);
+
+    // Reset: start a new round, with_dictionary: ibuf starts with the dictionary, encpos = its length.
+    void Reset(bool with_dictionary = false);
+
+    // SetDictionary: build dictionary buckets (len == 0 to remove).
+    void SetDictionary(const unsigned char* dict, int len);
+
+    // GetStats: match finder counters since construction, all zero unless built with ZLING_STATS=1.
+    const ZlingRolzStats& GetStats() const {
+        return m_stats;
+    }
 
 private:
-    int  Match(unsigned char* buf, int pos, int* match_idx, int* match_len);
-    void Update(unsigned char* buf, int pos);
+    int  Match(const unsigned char* buf, int pos, int* match_idx, int* match_len);
+    void Update(const unsigned char* buf, int pos);
 
+    // fields read on every position share the first cache line, see Prefetch().
     struct ZlingEncodeBucket {
-        uint16_t suffix[kBucketItemSize];
-        uint32_t offset[kBucketItemSize];
+        uint32_t epoch;
+        uint16_t generation;
         uint16_t head;
-        uint16_t hash[kBucketItemHash];
+        uint16_t count;  // nodes written since cleared (<= kBucketItemSize)
+        uint16_t hash[kBucketItemHash];  // node | generation << 12, other generations read as node 0
+        uint16_t suffix[kBucketItemSize];
+        uint32_t offset[kBucketItemSize];  // full positions, so a round can exceed 16MB (large window)
+        uint8_t  check[kBucketItemSize];   // hash check of each position
     };
     ZlingEncodeBucket m_buckets[256];
+    ZlingEncodeBucket* m_dict_buckets;
+    uint32_t m_epoch;
+    bool m_dict_active;
+    ZlingRolzStats m_stats;
+
+    inline ZlingEncodeBucket* GetBucket(int context);
+    inline void Insert(ZlingEncodeBucket* bucket, const unsigned char* buf, int pos);
+    inline void Prefetch(const unsigned char* buf, int pos);
+
+    int  m_match_depth;  // max chain nodes walked per position
+    int  m_match_nice;   // stop walking once a match this long is found
+    bool m_match_lazy;   // try a longer match at next position before taking one
 
     ZlingRolzEncoder(const ZlingRolzEncoder&);
     ZlingRolzEncoder& operator = (const ZlingRolzEncoder&);
@@ -90,17 +152,29 @@ private:
 class ZlingRolzDecoder {
 public:
     ZlingRolzDecoder() {
-        Reset();
+        memset(m_buckets, 0, sizeof(m_buckets));
+        m_epoch = 0;
+        m_dict_offset = NULL;
+        m_dict_active = false;
+    }
+    ~ZlingRolzDecoder() {
+        delete [] m_dict_offset;
     }
 
     /* Decode:
      *  arg ibuf:   input data (compressed)
      *  arg obuf:   output data
      *  arg ilen:   input data length
+     *  arg olen:   output data capacity, matches are never copied beyond obuf[olen - 1]
      *  arg decpos: start decoding at obuf[decpos], limited by ilen
      */
-    int  Decode(uint16_t* ibuf, unsigned char* obuf, int ilen, int* decpos);
-    void Reset();
+    int  Decode(uint16_t* ibuf, unsigned char* obuf, int ilen, int olen, int* decpos);
+
+    // Reset: start a new round, with_dictionary: obuf starts with the dictionary, decpos = its length.
+    void Reset(bool with_dictionary = false);
+
+    // SetDictionary: collect dictionary positions of each bucket (len == 0 to remove).
+    void SetDictionary(const unsigned char* dict, int len);
 
 private:
     int  GetMatch(unsigned char* buf, int pos, int idx);
@@ -109,8 +183,19 @@ private:
     struct ZlingDecodeBucket {
         uint32_t offset[kBucketItemSize];
         uint16_t head;
+        uint16_t count;  // nodes written since cleared (<= kBucketItemSize), others read as zero
+        uint32_t epoch;
     };
     ZlingDecodeBucket m_buckets[256];
+    uint32_t m_epoch;
+
+    // dictionary positions of bucket c: m_dict_offset[m_dict_start[c] .. + m_dict_count[c]], oldest first
+    uint32_t* m_dict_offset;
+    int m_dict_start[256];
+    int m_dict_count[256];
+    bool m_dict_active;
+
+    inline ZlingDecodeBucket* GetBucket(int context);
 
     ZlingRolzDecoder(const ZlingRolzDecoder&);
     ZlingRolzDecoder& operator = (const ZlingRolzDecoder&);
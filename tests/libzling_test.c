@@ -0,0 +1,399 @@
+/**
+ * zling:
+ *  light-weight lossless data compression utility.
+ *
+ * Copyright (C) 2012-2013 by Zhang Li <zhangli10 at baidu.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the project nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE PROJECT AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE PROJECT OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * @author zhangli10<zhangli10@baidu.com>
+ * @brief  libzling round-trip tests (C ABI), run by 'make test'.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "src/libzling.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+/* MakeData: text-like records, random and zero runs, so rounds get rolz, huffman (static/repeat)
+ *  and stored blocks.
+ */
+static unsigned char* MakeData(size_t size) {
+    static const char* words[] = {"GET ", "POST ", "/index.html ", "200 ", "404 ", "user=", "id=", "\n"};
+    unsigned char* data = malloc(size);
+    unsigned int seed = 12345;
+    size_t pos = 0;
+
+    while (pos < size) {
+        seed = seed * 1103515245 + 12345;
+        if (pos / 1048576 % 8 == 5) {  // random megabyte: stored blocks
+            data[pos++] = seed >> 16;
+        } else if (pos / 1048576 % 8 == 7) {  // zero megabyte
+            data[pos++] = 0;
+        } else {
+            const char* word = words[seed >> 16 & 7];
+            while (*word != 0 && pos < size) {
+                data[pos++] = *word++;
+            }
+            if (pos < size) {
+                data[pos++] = '0' + (seed >> 20) % 10;
+            }
+        }
+    }
+    return data;
+}
+
+static size_t Compress(zling_encoder* encoder, const unsigned char* data, size_t size, unsigned char** out) {
+    size_t len = zling_compress_bound(size);
+
+    *out = malloc(len + 16);
+    CHECK(zling_encoder_compress(encoder, data, size, *out, &len) == ZLING_OK);
+    return len;
+}
+
+/* TestRoundTrip: buffer and streaming round trips with encoder options. */
+static void TestRoundTrip(const unsigned char* data, size_t size, int level, int checksum, int pipeline) {
+    zling_encoder* encoder = zling_encoder_create();
+    zling_decoder* decoder = zling_decoder_create();
+    unsigned char* encoded;
+    unsigned char* decoded = malloc(size + 1);
+    size_t dlen = size + 1;
+
+    zling_encoder_set_option(encoder, ZLING_OPTION_LEVEL, level);
+    zling_encoder_set_option(encoder, ZLING_OPTION_CHECKSUM, checksum);
+    zling_encoder_set_option(encoder, ZLING_OPTION_PIPELINE, pipeline);
+    size_t elen = Compress(encoder, data, size, &encoded);
+
+    CHECK(zling_decoder_decompress(decoder, encoded, elen, decoded, &dlen) == ZLING_OK);
+    CHECK(dlen == size && memcmp(decoded, data, size) == 0);
+
+    // streaming, in odd-sized pieces on both sides
+    size_t ipos = 0;
+    size_t opos = 0;
+    int ret = ZLING_OK;
+
+    zling_decoder_reset(decoder);
+    while (ret == ZLING_OK) {
+        size_t ilen = (elen - ipos < 77777) ? elen - ipos : 77777;
+        size_t olen = (size + 1 - opos < 99999) ? size + 1 - opos : 99999;
+
+        ret = zling_decoder_process(decoder, encoded + ipos, &ilen, decoded + opos, &olen, ipos + ilen == elen);
+        ipos += ilen;
+        opos += olen;
+    }
+    CHECK(ret == ZLING_STREAM_END && opos == size && memcmp(decoded, data, size) == 0);
+
+    free(encoded);
+    free(decoded);
+    zling_encoder_destroy(encoder);
+    zling_decoder_destroy(decoder);
+    return;
+}
+
+static void TestStreamingEncoder(const unsigned char* data, size_t size) {
+    zling_encoder* encoder = zling_encoder_create();
+    size_t cap = zling_compress_bound(size);
+    unsigned char* encoded = malloc(cap);
+    unsigned char* decoded = malloc(size + 1);
+    size_t ipos = 0;
+    size_t opos = 0;
+    size_t dlen = size + 1;
+    int ret = ZLING_OK;
+
+    while (ret == ZLING_OK) {
+        size_t ilen = (size - ipos < 1000003) ? size - ipos : 1000003;
+        size_t olen = (cap - opos < 65536) ? cap - opos : 65536;
+
+        ret = zling_encoder_process(encoder, data + ipos, &ilen, encoded + opos, &olen, ipos + ilen == size);
+        ipos += ilen;
+        opos += olen;
+    }
+    CHECK(ret == ZLING_STREAM_END);
+    CHECK(zling_decompress(encoded, opos, decoded, &dlen) == ZLING_OK);
+    CHECK(dlen == size && memcmp(decoded, data, size) == 0);
+
+    free(encoded);
+    free(decoded);
+    zling_encoder_destroy(encoder);
+    return;
+}
+
+struct SinkState {
+    const unsigned char* data;
+    size_t pos;
+    int calls;
+    int mismatch;
+};
+
+static void Sink(const void* buf, size_t len, void* arg) {
+    struct SinkState* state = arg;
+
+    state->mismatch |= (memcmp(buf, state->data + state->pos, len) != 0);
+    state->pos += len;
+    state->calls++;
+    return;
+}
+
+static void TestSink(const unsigned char* data, size_t size) {
+    zling_encoder* encoder = zling_encoder_create();
+    zling_decoder* decoder = zling_decoder_create();
+    struct SinkState state = {data, 0, 0, 0};
+    unsigned char* encoded;
+    unsigned char dummy[16];
+    size_t elen = Compress(encoder, data, size, &encoded);
+    size_t ilen = elen;
+    size_t olen = sizeof(dummy);
+
+    zling_decoder_set_sink(decoder, Sink, &state);
+    CHECK(zling_decoder_process(decoder, encoded, &ilen, dummy, &olen, 1) == ZLING_STREAM_END);
+    CHECK(olen == 0 && state.pos == size && !state.mismatch);
+    CHECK(state.calls > 1);  // block by block, not one call per round
+
+    free(encoded);
+    zling_encoder_destroy(encoder);
+    zling_decoder_destroy(decoder);
+    return;
+}
+
+static void TestRange(const unsigned char* data, size_t size) {
+    zling_encoder* encoder = zling_encoder_create();
+    unsigned char* encoded;
+    unsigned char* decoded = malloc(size);
+    static const size_t ranges[][2] = {{0, 1}, {16777200, 100}, {123456, 5000000}, {0, 0}};
+
+    zling_encoder_set_option(encoder, ZLING_OPTION_SEEKABLE, 1);
+    size_t elen = Compress(encoder, data, size, &encoded);
+
+    for (int i = 0; i < 4; i++) {
+        size_t dlen = ranges[i][1];
+        CHECK(zling_decompress_range(encoded, elen, ranges[i][0], decoded, &dlen) == ZLING_OK);
+        CHECK(dlen == ranges[i][1] && memcmp(decoded, data + ranges[i][0], dlen) == 0);
+    }
+    size_t dlen = 100;  // range beyond the end of data is cut
+    CHECK(zling_decompress_range(encoded, elen, size - 10, decoded, &dlen) == ZLING_OK && dlen == 10);
+
+    free(encoded);
+    free(decoded);
+    zling_encoder_destroy(encoder);
+    return;
+}
+
+static void TestDictionary(const unsigned char* data) {
+    size_t sizes[64];
+    unsigned char dict[65536];
+    size_t dictlen = sizeof(dict);
+    zling_encoder* encoder = zling_encoder_create();
+    zling_decoder* decoder = zling_decoder_create();
+    unsigned char* encoded;
+    unsigned char decoded[4097];
+    size_t dlen = sizeof(decoded);
+
+    for (int i = 0; i < 64; i++) {
+        sizes[i] = 4096;
+    }
+    CHECK(zling_train_dictionary(data, sizes, 64, dict, &dictlen) == ZLING_OK && dictlen > 0);
+    CHECK(zling_encoder_set_dictionary(encoder, dict, dictlen) == ZLING_OK);
+    size_t elen = Compress(encoder, data + 300000, 4096, &encoded);
+
+    CHECK(zling_decompress(encoded, elen, decoded, &dlen) != ZLING_OK);  // no dictionary
+    dlen = sizeof(decoded);
+    CHECK(zling_decoder_set_dictionary(decoder, dict, dictlen) == ZLING_OK);
+    CHECK(zling_decoder_decompress(decoder, encoded, elen, decoded, &dlen) == ZLING_OK);
+    CHECK(dlen == 4096 && memcmp(decoded, data + 300000, 4096) == 0);
+
+    free(encoded);
+    zling_encoder_destroy(encoder);
+    zling_decoder_destroy(decoder);
+    return;
+}
+
+static void TestShortBuffer(const unsigned char* data, size_t size) {
+    zling_encoder* encoder = zling_encoder_create();
+    unsigned char* encoded;
+    unsigned char* decoded = malloc(size);
+    size_t elen = Compress(encoder, data, size, &encoded);
+    size_t dlen = size - 1;
+
+    CHECK(zling_decompress(encoded, elen, decoded, &dlen) == ZLING_BUF_ERROR);
+
+    free(encoded);
+    free(decoded);
+    zling_encoder_destroy(encoder);
+    return;
+}
+
+static void TestCorrupted(const unsigned char* data, size_t size) {
+    zling_encoder* encoder = zling_encoder_create();
+    unsigned char* encoded;
+    unsigned char* decoded = malloc(size);
+    size_t dlen = size;
+
+    zling_encoder_set_option(encoder, ZLING_OPTION_CHECKSUM, 1);
+    size_t elen = Compress(encoder, data, size, &encoded);
+
+    encoded[elen / 2] ^= 0x55;
+    CHECK(zling_decompress(encoded, elen, decoded, &dlen) == ZLING_ERROR);
+
+    free(encoded);
+    free(decoded);
+    zling_encoder_destroy(encoder);
+    return;
+}
+
+/* TestGuardPage: input ending right before an inaccessible page (as a mapped file of page-multiple
+ *  size), the encoder must not read beyond it.
+ */
+static void TestGuardPage(void) {
+    static const size_t sizes[] = {618496, 4096 * 37, 3000000};
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    for (int i = 0; i < 3; i++) {
+        size_t size = (sizes[i] + page - 1) / page * page;
+        unsigned char* map = mmap(NULL, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        CHECK(map != MAP_FAILED);
+        if (map == MAP_FAILED) {
+            continue;
+        }
+        CHECK(mprotect(map + size, page, PROT_NONE) == 0);
+        if (i == 2) {  // text with matches running to the end
+            unsigned char* data = MakeData(size);
+            memcpy(map, data, size);
+            free(data);
+        }
+
+        size_t elen = zling_compress_bound(size);
+        size_t dlen = size;
+        unsigned char* encoded = malloc(elen);
+        unsigned char* decoded = malloc(size);
+        CHECK(zling_compress(map, size, encoded, &elen) == ZLING_OK);
+        CHECK(zling_decompress(encoded, elen, decoded, &dlen) == ZLING_OK);
+        CHECK(dlen == size && memcmp(decoded, map, size) == 0);
+
+        free(encoded);
+        free(decoded);
+        munmap(map, size + page);
+    }
+    return;
+}
+
+static unsigned char* ReadFile(const char* path, size_t* size) {
+    FILE* fp = fopen(path, "rb");
+    unsigned char* data;
+
+    *size = 0;
+    if (fp == NULL) {
+        fprintf(stderr, "cannot open %s.\n", path);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    *size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = malloc(*size + 1);
+    CHECK(fread(data, 1, *size, fp) == *size);
+    fclose(fp);
+    return data;
+}
+
+/* TestStream: decode a stream written by 'zling e' (as with -W, a window frame and rounds over
+ *  16MB), whole and in pieces.
+ */
+static void TestStream(const char* encoded_path, const char* original_path) {
+    zling_decoder* decoder = zling_decoder_create();
+    size_t elen;
+    size_t size;
+    unsigned char* encoded = ReadFile(encoded_path, &elen);
+    unsigned char* data = ReadFile(original_path, &size);
+    unsigned char* decoded = malloc(size + 1);
+    size_t dlen = size + 1;
+
+    CHECK(zling_decoder_decompress(decoder, encoded, elen, decoded, &dlen) == ZLING_OK);
+    CHECK(dlen == size && memcmp(decoded, data, size) == 0);
+
+    size_t ipos = 0;
+    size_t opos = 0;
+    int ret = ZLING_OK;
+
+    zling_decoder_reset(decoder);
+    while (ret == ZLING_OK) {
+        size_t piece = (ipos == 0) ? 3 : 77777;  // window frame split too
+        size_t ilen = (elen - ipos < piece) ? elen - ipos : piece;
+        size_t olen = (size + 1 - opos < 99999) ? size + 1 - opos : 99999;
+
+        ret = zling_decoder_process(decoder, encoded + ipos, &ilen, decoded + opos, &olen, ipos + ilen == elen);
+        ipos += ilen;
+        opos += olen;
+    }
+    CHECK(ret == ZLING_STREAM_END && opos == size && memcmp(decoded, data, size) == 0);
+
+    free(encoded);
+    free(data);
+    free(decoded);
+    zling_decoder_destroy(decoder);
+    return;
+}
+
+int main(int argc, char** argv) {
+    if (argc == 3) {  // libzling_test encoded original: decode a CLI-encoded stream
+        TestStream(argv[1], argv[2]);
+        return failures > 0;
+    }
+    size_t size = 20000000;  // two rounds
+    unsigned char* data = MakeData(size);
+
+    TestRoundTrip(data, 0, 5, 0, 0);
+    TestRoundTrip(data, 1, 5, 0, 0);
+    TestRoundTrip(data, 1000, 1, 0, 0);
+    TestRoundTrip(data, size, 5, 0, 0);
+    TestRoundTrip(data, size, 1, 1, 1);
+    TestRoundTrip(data, 3000000, 9, 1, 0);
+    TestStreamingEncoder(data, size);
+    TestSink(data, size);
+    TestRange(data, size);
+    TestDictionary(data);
+    TestShortBuffer(data, 3000000);
+    TestCorrupted(data, 3000000);
+    TestGuardPage();
+
+    free(data);
+    if (failures > 0) {
+        fprintf(stderr, "libzling_test: %d checks failed.\n", failures);
+        return 1;
+    }
+    fprintf(stderr, "libzling_test: ok.\n");
+    return 0;
+}